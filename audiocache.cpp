@@ -0,0 +1,127 @@
+#include "audiocache.h"
+#include "cachedirectory.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+// Bump when the layout of the entries or the way audio is decoded changes, so that old ones are
+// ignored.
+#define AUDIO_CACHE_VERSION 2
+// Budget of the cache on disk, about 400 files of 600 s at 1024 Hz.
+#define AUDIO_CACHE_MAX_BYTES (1024LL * 1024 * 1024)
+
+// The header takes 64 bytes, which keeps the samples after it aligned in the file.
+struct AudioCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t sampleRate;
+    uint32_t reserved;
+    uint64_t sampleCount;
+    double start;
+    double duration;
+    char padding[24];
+};
+
+static_assert(sizeof(AudioCacheHeader) == 64, "AudioCacheHeader must be 64 bytes");
+
+static const char audioCacheMagic[4] = { 'N', 'M', 'I', 'A' };
+
+static CacheDirectory &audioCacheDirectory()
+{
+    static CacheDirectory directory(
+                QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/audio",
+                "*.pcm", AUDIO_CACHE_MAX_BYTES);
+    return directory;
+}
+
+QString AudioCache::entryPath(const QString &path, int sampleRate, double start, double duration)
+{
+    QFileInfo fileInfo(path);
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(fileInfo.absoluteFilePath().toUtf8());
+    hash.addData(QByteArray::number(fileInfo.size()));
+    hash.addData(QByteArray::number(fileInfo.lastModified().toMSecsSinceEpoch()));
+    hash.addData(QByteArray::number(sampleRate));
+    hash.addData(QByteArray::number(start));
+    hash.addData(QByteArray::number(duration));
+    hash.addData(QByteArray::number(AUDIO_CACHE_VERSION));
+
+    return audioCacheDirectory().path() + "/" + QString::fromLatin1(hash.result().toHex()) + ".pcm";
+}
+
+FloatSignal* AudioCache::load(const QString &path, int sampleRate, double start, double duration)
+{
+    // the samples are read into a signal of their own rather than mapped, since a mapping keeps
+    // its file open, and a whole library of them would run out of file descriptors
+    const QString entry = entryPath(path, sampleRate, start, duration);
+    QFile file(entry);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return nullptr;
+    }
+
+    AudioCacheHeader header;
+    if (file.read((char*)&header, sizeof(header)) != (qint64)sizeof(header)) {
+        return nullptr;
+    }
+    const qint64 sampleBytes = header.sampleCount * sizeof(float);
+    const bool valid = memcmp(header.magic, audioCacheMagic, sizeof(audioCacheMagic)) == 0
+            && header.version == AUDIO_CACHE_VERSION
+            && header.sampleRate == (uint32_t)sampleRate
+            && header.sampleCount > 0
+            && (qint64)sizeof(header) + sampleBytes == file.size();
+    if (!valid) {
+        return nullptr;
+    }
+
+    std::unique_ptr<FloatSignal> signal(new FloatSignal((size_t)header.sampleCount));
+    if (file.read((char*)signal->getData(), sampleBytes) != sampleBytes) {
+        return nullptr;
+    }
+    file.close();
+    CacheDirectory::touch(entry);
+
+    return signal.release();
+}
+
+void AudioCache::store(const QString &path, int sampleRate, double start, double duration,
+                       const FloatSignal *signal)
+{
+    if (signal == nullptr || signal->getSize() == 0) {
+        return;
+    }
+
+    const QString entry = entryPath(path, sampleRate, start, duration);
+    if (!QDir().mkpath(QFileInfo(entry).absolutePath())) {
+        return;
+    }
+
+    AudioCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, audioCacheMagic, sizeof(audioCacheMagic));
+    header.version = AUDIO_CACHE_VERSION;
+    header.sampleRate = (uint32_t)sampleRate;
+    header.sampleCount = signal->getSize();
+    header.start = start;
+    header.duration = duration;
+
+    // QSaveFile writes to a temporary file and renames it on commit, so other threads and
+    // sessions never see a half-written entry
+    QSaveFile file(entry);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return;
+    }
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)signal->getData(), sizeof(float) * signal->getSize());
+    if (!file.commit()) {
+        std::cerr << "Unable to write audio cache entry for " << path.toStdString() << std::endl;
+        return;
+    }
+    audioCacheDirectory().added((qint64)(sizeof(header) + sizeof(float) * signal->getSize()));
+}
@@ -0,0 +1,30 @@
+#ifndef AUDIOCACHE_H
+#define AUDIOCACHE_H
+
+#include <QString>
+#include "signals.h"
+
+// Persistent cache of decoded audio, so that files which have already been seen don't have to go
+// through ffmpeg again. Entries are content-addressed: the name of each one is a hash of the
+// file's absolute path, size and modification time plus the decode parameters, so any change to
+// the file or the parameters simply misses the cache. Each entry is a small header followed by
+// the raw float samples, which are read straight into the signal, without any parsing. The cache
+// is kept under a size budget, the least recently used entries going first (see CacheDirectory).
+// All the functions are thread-safe, and failing to read or write the cache is never an error:
+// it just behaves as a miss.
+class AudioCache
+{
+public:
+    // Returns the cached samples of the file decoded with the given parameters, or nullptr if
+    // they aren't cached.
+    static FloatSignal* load(const QString &path, int sampleRate, double start, double duration);
+    // Stores the decoded samples of the file for later sessions, deleting the least recently used
+    // entries if the cache gets over its budget.
+    static void store(const QString &path, int sampleRate, double start, double duration,
+                      const FloatSignal *signal);
+
+private:
+    static QString entryPath(const QString &path, int sampleRate, double start, double duration);
+};
+
+#endif // AUDIOCACHE_H
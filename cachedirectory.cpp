@@ -0,0 +1,58 @@
+#include "cachedirectory.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QStringList>
+
+// Trimming goes down to this part of the budget, so that the directory isn't listed again for
+// every entry stored after it's full.
+#define CACHE_TRIM_NUMERATOR 3
+#define CACHE_TRIM_DENOMINATOR 4
+
+CacheDirectory::CacheDirectory(const QString &path, const QString &nameFilter, qint64 maxBytes)
+    : directory(path), nameFilter(nameFilter), maxBytes(maxBytes), usedBytes(-1)
+{
+}
+
+void CacheDirectory::touch(const QString &entryPath)
+{
+    // setting the time needs write access on some systems, appending nothing doesn't change the
+    // entry, and an entry deleted meanwhile isn't created again
+    QFile file(entryPath);
+    if (file.open(QIODevice::Append | QIODevice::ExistingOnly)) {
+        file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    }
+}
+
+void CacheDirectory::added(qint64 bytes)
+{
+    QMutexLocker locker(&mutex);
+    if (usedBytes >= 0) {
+        usedBytes += bytes;
+        if (usedBytes <= maxBytes) {
+            return;
+        }
+    }
+
+    // the oldest first; this is also how the size is known the first time, new entry included
+    const QFileInfoList entries = QDir(directory).entryInfoList(
+                QStringList(nameFilter), QDir::Files, QDir::Time | QDir::Reversed);
+    usedBytes = 0;
+    for (const QFileInfo &entry : entries) {
+        usedBytes += entry.size();
+    }
+    if (usedBytes <= maxBytes) {
+        return;
+    }
+    const qint64 targetBytes = maxBytes / CACHE_TRIM_DENOMINATOR * CACHE_TRIM_NUMERATOR;
+    for (const QFileInfo &entry : entries) {
+        if (usedBytes <= targetBytes) {
+            break;
+        }
+        if (QFile::remove(entry.absoluteFilePath())) {
+            usedBytes -= entry.size();
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef CACHEDIRECTORY_H
+#define CACHEDIRECTORY_H
+
+#include <QMutex>
+#include <QString>
+
+// A directory of disk cache entries kept under a size budget: when storing an entry takes the
+// entries over it, the least recently used ones are deleted. Use is told by the modification time,
+// which the caches update whenever they load an entry (see touch), so entries that keep being used
+// stay however old they are. Deleting is best effort: entries that can't be deleted (say, open on
+// Windows) are skipped.
+// Used by the audio and thumbnail caches. All the functions are thread-safe.
+class CacheDirectory
+{
+public:
+    // Only the files of the directory that match the name filter (like "*.pcm") are entries.
+    CacheDirectory(const QString &path, const QString &nameFilter, qint64 maxBytes);
+
+    const QString &path() const { return directory; }
+    // Marks the entry as just used, so that it's among the last ones to be deleted.
+    static void touch(const QString &entryPath);
+    // Accounts for an entry of the given size that was just written, and deletes the least
+    // recently used entries if they take more than the budget.
+    void added(qint64 bytes);
+
+private:
+    QString directory;
+    QString nameFilter;
+    qint64 maxBytes;
+    QMutex mutex;
+    // total size of the entries, or -1 until the directory has been listed
+    qint64 usedBytes;
+};
+
+#endif // CACHEDIRECTORY_H
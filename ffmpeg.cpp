@@ -7,34 +7,224 @@ extern "C"
 #include <libswresample/swresample.h>
 #include <libswscale/swscale.h>
 }
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <iostream>
+#include <list>
+#include <map>
+#include <utility>
+#include <vector>
+#include "readahead.h"
 #include "videolistitem.h"
 
-int decode_audio_file(const char* path, const int sample_rate, float** data, int* size, double start, double duration) {
-    // get format from audio file
-    AVFormatContext* format = avformat_alloc_context();
-    if (avformat_open_input(&format, path, NULL, NULL) != 0) {
+// Media sessions closed after their last use stay open until this many newer ones have been used.
+#define MAX_OPEN_MEDIA_SESSIONS 8
+
+// Size of the buffer between the demuxer and the read-ahead file. The read-ahead file does the
+// large reads, so this only saves calls into it.
+#define MEDIA_IO_BUFFER_SIZE 65536
+
+// Threads of each software thumbnail decoder. Thumbnails are decoded on a small pool of their own
+// (see TaskScheduler), so this is per pool thread, on top of the threads of the search.
+#define THUMBNAIL_DECODER_THREADS 2
+
+MediaSession::~MediaSession() {
+    // custom I/O isn't freed by the format context
+    avformat_close_input(&format);
+    if (io != NULL) {
+        av_freep(&io->buffer);
+        avio_context_free(&io);
+    }
+    delete file;
+}
+
+static int read_ahead_packet(void* opaque, uint8_t* buffer, int size) {
+    const int count = ((ReadAheadFile*)opaque)->read(buffer, size);
+    if (count < 0) {
+        return AVERROR(EIO);
+    }
+
+    return count == 0 ? AVERROR_EOF : count;
+}
+
+static int64_t read_ahead_seek(void* opaque, int64_t offset, int whence) {
+    ReadAheadFile* file = (ReadAheadFile*)opaque;
+    if (whence & AVSEEK_SIZE) {
+        return file->size();
+    }
+    const int64_t position = file->seek(offset, whence & ~AVSEEK_FORCE);
+
+    return position < 0 ? AVERROR(EINVAL) : position;
+}
+
+static std::shared_ptr<MediaSession> open_media_session(const char* path) {
+    std::shared_ptr<MediaSession> session = std::make_shared<MediaSession>();
+    session->format = avformat_alloc_context();
+    session->io = NULL;
+    // regular files are read through the read-ahead file, anything else (like URLs) is left to
+    // libavformat
+    session->file = ReadAheadFile::open(path);
+    if (session->file != NULL) {
+        uint8_t* buffer = (uint8_t*)av_malloc(MEDIA_IO_BUFFER_SIZE);
+        session->io = avio_alloc_context(buffer, MEDIA_IO_BUFFER_SIZE, 0, session->file,
+                                         read_ahead_packet, NULL, read_ahead_seek);
+        session->format->pb = session->io;
+        session->format->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    // on failure the format context is freed, and the session's destructor takes care of the rest
+    if (avformat_open_input(&session->format, path, NULL, NULL) != 0) {
         fprintf(stderr, "Could not open file '%s'\n", path);
-        return -1;
+        return nullptr;
     }
+    AVFormatContext* format = session->format;
     if (avformat_find_stream_info(format, NULL) < 0) {
         fprintf(stderr, "Could not retrieve stream info from file '%s'\n", path);
+        return nullptr;
+    }
+
+    session->path = path;
+    session->audio_codec = NULL;
+    session->video_codec = NULL;
+    session->audio_stream_index = av_find_best_stream(format, AVMEDIA_TYPE_AUDIO, -1, -1, &session->audio_codec, 0);
+    session->video_stream_index = av_find_best_stream(format, AVMEDIA_TYPE_VIDEO, -1, -1, &session->video_codec, 0);
+
+    return session;
+}
+
+std::shared_ptr<MediaSession> acquire_media_session(const char* path) {
+    static std::mutex sessions_mutex;
+    // most recently used at the front
+    static std::list<std::shared_ptr<MediaSession>> sessions;
+
+    {
+        std::lock_guard<std::mutex> lock(sessions_mutex);
+        for (auto it = sessions.begin(); it != sessions.end(); ++it) {
+            if ((*it)->path == path) {
+                sessions.splice(sessions.begin(), sessions, it);
+                return sessions.front();
+            }
+        }
+    }
+
+    // probing can be slow (think of a network share), so other files can be looked up meanwhile
+    std::shared_ptr<MediaSession> session = open_media_session(path);
+    if (!session) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(sessions_mutex);
+    for (auto &other : sessions) {
+        // another thread opened the same file in the meantime
+        if (other->path == path) {
+            return other;
+        }
+    }
+    sessions.push_front(session);
+    if (sessions.size() > MAX_OPEN_MEDIA_SESSIONS) {
+        // the session stays open until whoever is using it is done
+        sessions.pop_back();
+    }
+
+    return session;
+}
+
+// Makes the demuxer skip the packets of every stream but the given one.
+static void select_only_stream(AVFormatContext* format, const int stream_index) {
+    for (unsigned int i = 0; i < format->nb_streams; ++i) {
+        format->streams[i]->discard = (int)i == stream_index ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    }
+}
+
+// Returns the byte ranges of the packets of the stream up to the given time, sorted, according
+// to the container's index. The list is empty if the index doesn't know where the packets are and
+// how large they are: MP4 sample tables do, but MKV cues, for instance, only point to clusters.
+static std::vector<std::pair<int64_t, int64_t>> indexed_packet_ranges(const AVStream* stream, double end) {
+    std::vector<std::pair<int64_t, int64_t>> ranges;
+    for (int i = 0; i < stream->nb_index_entries; ++i) {
+        const AVIndexEntry &entry = stream->index_entries[i];
+        if (entry.pos < 0 || entry.size <= 0) {
+            return std::vector<std::pair<int64_t, int64_t>>();
+        }
+        if (entry.timestamp * av_q2d(stream->time_base) > end) {
+            continue;
+        }
+        ranges.push_back(std::make_pair(entry.pos, entry.pos + entry.size));
+    }
+    std::sort(ranges.begin(), ranges.end());
+
+    return ranges;
+}
+
+// Returns a new reference to the hardware device of the given type, which is created the first time
+// and then shared by all the decoders, or NULL if it can't be created. Devices that failed to be
+// created aren't tried again, so machines without a GPU don't pay for it on every thumbnail.
+static AVBufferRef* acquire_hw_device(const AVHWDeviceType type) {
+    static std::mutex devices_mutex;
+    static std::map<AVHWDeviceType, AVBufferRef*> devices;
+
+    std::lock_guard<std::mutex> lock(devices_mutex);
+    auto found = devices.find(type);
+    if (found == devices.end()) {
+        AVBufferRef* device = NULL;
+        if (av_hwdevice_ctx_create(&device, type, NULL, NULL, 0) < 0) {
+            device = NULL;
+        }
+        found = devices.insert(std::make_pair(type, device)).first;
+    }
+
+    return found->second == NULL ? NULL : av_buffer_ref(found->second);
+}
+
+// Makes a resampler from the format of the decoded frames to mono float at sample_rate, set up for
+// analysis at a very low rate rather than for listening: the surround and LFE channels are dropped
+// instead of mixed in, since they are where the two recordings of an intro differ the most, and the
+// anti-aliasing filter is much shorter than the default. At ratios like 48000/1024 the filter is
+// stretched over dozens of input samples per tap, so the default length mostly costs time, and
+// the error it saves is far below what the correlation can tell apart.
+static SwrContext* alloc_analysis_resampler(const AVFrame* frame, const int sample_rate) {
+    uint64_t in_channel_layout = frame->channel_layout;
+    if (in_channel_layout == 0) {
+        in_channel_layout = av_get_default_channel_layout(frame->channels);
+    }
+    struct SwrContext* swr = swr_alloc();
+    av_opt_set_int(swr, "in_channel_count", frame->channels, 0);
+    av_opt_set_int(swr, "out_channel_count", 1, 0);
+    av_opt_set_channel_layout(swr, "in_channel_layout", in_channel_layout, 0);
+    av_opt_set_channel_layout(swr, "out_channel_layout", AV_CH_LAYOUT_MONO, 0);
+    av_opt_set_int(swr, "in_sample_rate", frame->sample_rate, 0);
+    av_opt_set_int(swr, "out_sample_rate", sample_rate, 0);
+    av_opt_set_sample_fmt(swr, "in_sample_fmt", (AVSampleFormat)frame->format, 0);
+    av_opt_set_sample_fmt(swr, "out_sample_fmt", AV_SAMPLE_FMT_FLT, 0);
+    av_opt_set_double(swr, "surround_mix_level", 0.0, 0);
+    av_opt_set_double(swr, "lfe_mix_level", 0.0, 0);
+    av_opt_set_int(swr, "filter_size", 8, 0);
+    av_opt_set_int(swr, "phase_shift", 6, 0);
+    swr_init(swr);
+    if (!swr_is_initialized(swr)) {
+        swr_free(&swr);
+        return NULL;
+    }
+
+    return swr;
+}
+
+int decode_audio_stream(const char* path, const int sample_rate, double start, double duration,
+                        const AudioBlockConsumer& consumer) {
+    // get format from audio file
+    std::shared_ptr<MediaSession> session = acquire_media_session(path);
+    if (!session) {
         return -1;
     }
+    std::lock_guard<std::mutex> session_lock(session->mutex);
+    AVFormatContext* format = session->format;
 
     // Find the stream and its codec
-    AVCodec* audio_codec;
-    int stream_index = av_find_best_stream(
-        format,              // The media stream
-        AVMEDIA_TYPE_AUDIO,   // The type of stream we are looking for - audio for example
-        -1,                   // Desired stream number, -1 for any
-        -1,                   // Number of related stream, -1 for none
-        &audio_codec,          // Gets the codec associated with the stream, can be NULL
-        0                     // Flags - not used currently
-                                           );
-
-    if (stream_index == AVERROR_STREAM_NOT_FOUND || !audio_codec) {
+    AVCodec* audio_codec = session->audio_codec;
+    int stream_index = session->audio_stream_index;
+
+    if (stream_index < 0 || !audio_codec) {
         fprintf(stderr, "Could not retrieve audio stream from file '%s'\n", path);
         return -1;
     }
@@ -43,7 +233,6 @@ int decode_audio_file(const char* path, const int sample_rate, float** data, int
     AVCodecContext* codec_context = avcodec_alloc_context3(audio_codec);
     if (!codec_context) {
         fprintf(stderr, "Failed to alloc codec context for stream #%u in file '%s'\n", stream_index, path);
-        avformat_close_input(&format);
         return -1;
     }
 
@@ -54,34 +243,31 @@ int decode_audio_file(const char* path, const int sample_rate, float** data, int
                                                );
     if (result < 0) {
         fprintf(stderr, "Failed to make codec context from paramers for stream #%u in file '%s'\n", stream_index, path);
-        avformat_close_input(&format);
         avcodec_free_context(&codec_context);
         return -1;
     }
 
+    // only the front channels are analysed, so decoders that can downmix while decoding (AC-3,
+    // E-AC-3, DTS, TrueHD...) are asked for stereo, which lets them skip the surround channels
+    codec_context->request_channel_layout = AV_CH_LAYOUT_STEREO;
+
     if (avcodec_open2(codec_context, audio_codec, NULL) < 0) {
         fprintf(stderr, "Failed to open decoder for stream #%u in file '%s'\n", stream_index, path);
-        avformat_close_input(&format);
         avcodec_free_context(&codec_context);
         return -1;
     }
 
-    // prepare resampler
-    struct SwrContext* swr = swr_alloc();
-    av_opt_set_int(swr, "in_channel_count", format->streams[stream_index]->codecpar->channels, 0);
-    av_opt_set_int(swr, "out_channel_count", 1, 0);
-    av_opt_set_channel_layout(swr, "in_channel_layout", format->streams[stream_index]->codecpar->channel_layout, 0);
-    av_opt_set_channel_layout(swr, "out_channel_layout", AV_CH_LAYOUT_MONO, 0);
-    av_opt_set_int(swr, "in_sample_rate", format->streams[stream_index]->codecpar->sample_rate, 0);
-    av_opt_set_int(swr, "out_sample_rate", sample_rate, 0);
-    av_opt_set_sample_fmt(swr, "in_sample_fmt", codec_context->sample_fmt, 0);
-    av_opt_set_sample_fmt(swr, "out_sample_fmt", AV_SAMPLE_FMT_FLT, 0);
-    swr_init(swr);
-    if (!swr_is_initialized(swr)) {
-        fprintf(stderr, "Resampler has not been properly initialized\n");
-        return -1;
+    // only the audio stream is needed: let the demuxer skip the packets of all the others, and
+    // where the index says where they are, don't even read the bytes of the others ahead
+    select_only_stream(format, stream_index);
+    if (session->file != NULL) {
+        session->file->setWantedRanges(indexed_packet_ranges(format->streams[stream_index], start + duration));
     }
 
+    // the resampler is made for the first decoded frame, since the channels the decoder
+    // outputs depend on whether it honoured the downmix request
+    struct SwrContext* swr = NULL;
+
     // prepare to read data
     AVPacket packet;
     av_init_packet(&packet);
@@ -93,14 +279,16 @@ int decode_audio_file(const char* path, const int sample_rate, float** data, int
     packet.data = NULL;
     packet.size = 0;
 
+    // the resampled samples of each frame, reused as long as frames fit in it
+    float* buffer = NULL;
+    int buffer_capacity = 0;
+    bool stopped = false;
+
     // iterate through frames
-    size_t capacity = sample_rate * ((size_t)duration + 1);
-    *data = (float *)malloc(sizeof(float) * capacity);
-    *size = 0;
     int seek_ts = (int)std::round(start * format->streams[stream_index]->time_base.den / format->streams[stream_index]->time_base.num);
     av_seek_frame(format, stream_index, seek_ts, AVSEEK_FLAG_ANY);
 
-    while (av_read_frame(format, &packet) >= 0) {
+    while (!stopped && av_read_frame(format, &packet) >= 0) {
         if (packet.stream_index != stream_index) {
             av_packet_unref(&packet);
             continue;
@@ -108,57 +296,103 @@ int decode_audio_file(const char* path, const int sample_rate, float** data, int
         double t = (double)packet.pts * format->streams[stream_index]->time_base.num / format->streams[stream_index]->time_base.den;
         // fprintf(stdout, "Time: %f\n", t);
         if (t > start + duration - 1) {
+            av_packet_unref(&packet);
             break;
         }
 
-        // decode one frame
+        // decode the packet
         int ret = avcodec_send_packet(codec_context, &packet);
+        av_packet_unref(&packet);
         if (ret < 0) {
-            av_packet_unref(&packet);
             fprintf(stderr, "Failed to send packet for stream #%u in file '%s'\n", stream_index, path);
             break;
         }
 
-        ret = avcodec_receive_frame(codec_context, frame);
-        if (ret != 0) {
-            av_packet_unref(&packet);
-            break;
+        // a packet may hold any number of frames, or none yet
+        while (!stopped && (ret = avcodec_receive_frame(codec_context, frame)) == 0) {
+            if (swr == NULL) {
+                swr = alloc_analysis_resampler(frame, sample_rate);
+                if (swr == NULL) {
+                    fprintf(stderr, "Resampler has not been properly initialized\n");
+                    stopped = true;
+                    break;
+                }
+            }
+            // resample the frame, growing the buffer only when it doesn't fit
+            const int out_samples = swr_get_out_samples(swr, frame->nb_samples);
+            if (out_samples > buffer_capacity) {
+                av_freep(&buffer);
+                buffer_capacity = 0;
+                if (av_samples_alloc((uint8_t**)&buffer, NULL, 1, out_samples, AV_SAMPLE_FMT_FLT, 0) < 0) {
+                    fprintf(stderr, "Failed to allocate resampling buffer for file '%s'\n", path);
+                    stopped = true;
+                    break;
+                }
+                buffer_capacity = out_samples;
+            }
+            int frame_count = swr_convert(swr, (uint8_t**)&buffer, buffer_capacity, (const uint8_t**)frame->data, frame->nb_samples);
+            if (frame_count < 0) {
+                fprintf(stderr, "Failed to convert #%u in file '%s'\n", stream_index, path);
+                stopped = true;
+                break;
+            }
+            // hand the block over
+            if (frame_count > 0 && !consumer(buffer, frame_count)) {
+                stopped = true;
+            }
         }
-        // resample frames
-        double* buffer;
-        av_samples_alloc((uint8_t**)&buffer, NULL, 1, frame->nb_samples, AV_SAMPLE_FMT_FLT, 0);
-        int frame_count = swr_convert(swr, (uint8_t**)&buffer, frame->nb_samples, (const uint8_t**)frame->data, frame->nb_samples);
-        if (frame_count < 0) {
-            av_freep(&buffer);
-            av_packet_unref(&packet);
-            fprintf(stderr, "Failed to convert #%u in file '%s'\n", stream_index, path);
+        if (ret != 0 && ret != AVERROR(EAGAIN)) {
             break;
         }
-        // append resampled frames to data
-        memcpy(*data + *size, buffer, frame_count * sizeof(float));
-        *size += frame_count;
-        av_freep(&buffer);
-        av_packet_unref(&packet);
-    }
-    if (*size > 0) {
-        float *new_data = (float*)realloc(*data, sizeof(float) * (*size));
-        if (new_data == NULL) {
-            free(*data);
-            *data = NULL;
-            size = 0;
-        }
-        else {
-            *data = new_data;
-        }
     }
 
     // clean up
-    avformat_close_input(&format);
+    if (session->file != NULL) {
+        session->file->setWantedRanges(std::vector<std::pair<int64_t, int64_t>>());
+    }
+    av_freep(&buffer);
     av_frame_free(&frame);
     swr_free(&swr);
     avcodec_close(codec_context);
     avcodec_free_context(&codec_context);
-    avformat_free_context(format);
+
+    // success
+    return 0;
+}
+
+int decode_audio_file(const char* path, const int sample_rate, float** data, int* size, double start, double duration) {
+    size_t capacity = sample_rate * ((size_t)duration + 1);
+    *data = (float *)malloc(sizeof(float) * capacity);
+    *size = 0;
+
+    // append every block, growing the array if the window holds more samples than expected
+    int result = decode_audio_stream(path, sample_rate, start, duration,
+                                     [&](const float* samples, int count) {
+        if (*size + (size_t)count > capacity) {
+            capacity = std::max(capacity * 2, *size + (size_t)count);
+            float *new_data = (float*)realloc(*data, sizeof(float) * capacity);
+            if (new_data == NULL) {
+                return false;
+            }
+            *data = new_data;
+        }
+        memcpy(*data + *size, samples, count * sizeof(float));
+        *size += count;
+        return true;
+    });
+    if (result != 0) {
+        free(*data);
+        *data = NULL;
+        *size = 0;
+        return result;
+    }
+
+    if (*size > 0) {
+        float *new_data = (float*)realloc(*data, sizeof(float) * (*size));
+        if (new_data != NULL) {
+            *data = new_data;
+        }
+    }
 
     // success
     return 0;
@@ -180,91 +414,148 @@ AVPixelFormat get_hw_format(AVCodecContext *ctx, const AVPixelFormat *pix_fmts)
 }
 
 
-int get_video_frames(Image **images, const char* path, double start, double end, int count, int height) {
+// Opens a decoder for thumbnails, on the given hardware device, or if it's NULL, in software with
+// slice threading on THUMBNAIL_DECODER_THREADS threads. Frame threading is left out on purpose:
+// it holds back as many frames as it has threads before the first one comes out, and thumbnails
+// seek before almost every frame, so they would pay that delay every time. Either way it favours
+// speed over quality, since the frames end up 100 pixels high: the deblocking filter is skipped
+// and non-compliant speedups are allowed. hw_pix_fmt must outlive the decoder. Returns NULL on
+// failure.
+static AVCodecContext* open_video_decoder(AVCodec* codec, const AVCodecParameters* parameters,
+                                          AVBufferRef* hw_device_ctx, AVPixelFormat* hw_pix_fmt) {
+    AVCodecContext* codec_context = avcodec_alloc_context3(codec);
+    if (!codec_context) {
+        return NULL;
+    }
+    if (avcodec_parameters_to_context(codec_context, parameters) < 0) {
+        avcodec_free_context(&codec_context);
+        return NULL;
+    }
+
+    if (hw_device_ctx != NULL) {
+        codec_context->opaque = hw_pix_fmt;
+        codec_context->get_format = get_hw_format;
+        codec_context->hw_device_ctx = av_buffer_ref(hw_device_ctx);
+    } else {
+        codec_context->thread_count = THUMBNAIL_DECODER_THREADS;
+        codec_context->thread_type = FF_THREAD_SLICE;
+    }
+    codec_context->skip_loop_filter = AVDISCARD_ALL;
+    codec_context->flags2 |= AV_CODEC_FLAG2_FAST;
+
+    if (avcodec_open2(codec_context, codec, NULL) < 0) {
+        avcodec_free_context(&codec_context);
+        return NULL;
+    }
+
+    return codec_context;
+}
+
+static int64_t seconds_to_ts(const AVStream* stream, double seconds) {
+    return (int64_t)std::round(seconds * stream->time_base.den / stream->time_base.num);
+}
+
+// The timestamp of the last keyframe at or before ts according to the index, that is, where
+// decoding has to start to reach ts, or AV_NOPTS_VALUE if the index doesn't know.
+static int64_t keyframe_before(AVStream* stream, int64_t ts) {
+    const int idx = av_index_search_timestamp(stream, ts, AVSEEK_FLAG_BACKWARD);
+    return idx < 0 ? AV_NOPTS_VALUE : stream->index_entries[idx].timestamp;
+}
+
+// The keyframe closest to ts according to the index, before or after it, or AV_NOPTS_VALUE if the
+// index doesn't know any.
+static int64_t nearest_keyframe(AVStream* stream, int64_t ts) {
+    const int64_t before = keyframe_before(stream, ts);
+    const int idx = av_index_search_timestamp(stream, ts, 0);
+    const int64_t after = idx < 0 ? AV_NOPTS_VALUE : stream->index_entries[idx].timestamp;
+    if (before == AV_NOPTS_VALUE) {
+        return after;
+    }
+    if (after == AV_NOPTS_VALUE || ts - before <= after - ts) {
+        return before;
+    }
+
+    return after;
+}
+
+// Seeks to where the thumbnail at ts has to be decoded from, and returns the timestamp of the frame
+// to take: ts itself, or if exact timing isn't needed, the keyframe closest to it.
+static int64_t seek_to_thumbnail(AVFormatContext* format, AVStream* stream, int64_t ts, bool exact) {
+    if (!exact) {
+        const int64_t keyframe = nearest_keyframe(stream, ts);
+        if (keyframe != AV_NOPTS_VALUE) {
+            ts = keyframe;
+        }
+    }
+    av_seek_frame(format, stream->index, ts, AVSEEK_FLAG_BACKWARD);
+
+    return ts;
+}
+
+int get_video_frames(std::vector<Image> *images, const char* path, double start, double end, int count, int height, bool exact) {
     /*enum AVHWDeviceType type = AV_HWDEVICE_TYPE_NONE;
     while((type = av_hwdevice_iterate_types(type)) != AV_HWDEVICE_TYPE_NONE) {
         std::cout << av_hwdevice_get_type_name(type) << std::endl;
     }*/
 
-    AVFormatContext* format = avformat_alloc_context();
-    if (avformat_open_input(&format, path, NULL, NULL) != 0) {
-        fprintf(stderr, "Could not open file '%s'\n", path);
+    std::shared_ptr<MediaSession> session = acquire_media_session(path);
+    if (!session) {
         return -1;
     }
-    if (avformat_find_stream_info(format, NULL) < 0) {
-        fprintf(stderr, "Could not retrieve stream info from file '%s'\n", path);
-        return -1;
+    std::unique_lock<std::mutex> session_lock(session->mutex, std::try_to_lock);
+    if (!session_lock.owns_lock()) {
+        // the session is busy, most likely decoding the audio, which takes far longer than the
+        // thumbnails: rather than waiting, open the file again just for them, and close it after
+        session = open_media_session(path);
+        if (!session) {
+            return -1;
+        }
+        session_lock = std::unique_lock<std::mutex>(session->mutex);
     }
+    AVFormatContext* format = session->format;
 
     // Find the stream and its codec
-    AVCodec* video_codec;
-    int stream_index = av_find_best_stream(
-        format,              // The media stream
-        AVMEDIA_TYPE_VIDEO,   // The type of stream we are looking for - audio for example
-        -1,                   // Desired stream number, -1 for any
-        -1,                   // Number of related stream, -1 for none
-        &video_codec,          // Gets the codec associated with the stream, can be NULL
-        0                     // Flags - not used currently
-                                           );
-
-    if (stream_index == AVERROR_STREAM_NOT_FOUND || !video_codec) {
+    AVCodec* video_codec = session->video_codec;
+    int stream_index = session->video_stream_index;
+
+    if (stream_index < 0 || !video_codec) {
         fprintf(stderr, "Could not retrieve video stream from file '%s'\n", path);
         return -1;
     }
+    select_only_stream(format, stream_index);
 
-    const AVCodecHWConfig *hwconfig;
+    // use the first hardware decoder whose device is actually available on this machine, and
+    // decode in software if there is none
+    AVPixelFormat hw_pix_fmt = AV_PIX_FMT_NONE;
+    AVBufferRef *hw_device_ctx = NULL;
     for (int i = 0;; ++i) {
-        hwconfig = avcodec_get_hw_config(video_codec, i);
+        const AVCodecHWConfig *hwconfig = avcodec_get_hw_config(video_codec, i);
         if (!hwconfig) {
             break;
         }
         if (!(hwconfig->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX)) {
             continue;
         }
+        hw_device_ctx = acquire_hw_device(hwconfig->device_type);
+        if (hw_device_ctx == NULL) {
+            continue;
+        }
+        hw_pix_fmt = hwconfig->pix_fmt;
         std::cout << "Chosen hw type: " << av_hwdevice_get_type_name(hwconfig->device_type) << std::endl;
         break;
     }
 
-    // Get the codec context
-    AVCodecContext* codec_context = avcodec_alloc_context3(video_codec);
-    if (!codec_context) {
-        fprintf(stderr, "Failed to alloc codec context for stream #%u in file '%s'\n", stream_index, path);
-        avformat_close_input(&format);
-        return -1;
-    }
-    AVPixelFormat hwpixformat = hwconfig->pix_fmt;
-    codec_context->opaque = malloc(sizeof(AVPixelFormat));
-    AVPixelFormat *opaque = (AVPixelFormat*)codec_context->opaque;
-    *opaque = hwpixformat;
-
-    // Set the parameters of the codec context from the stream
-    int result = avcodec_parameters_to_context(
-        codec_context,
-        format->streams[stream_index]->codecpar
-                                               );
-    if (result < 0) {
-        fprintf(stderr, "Failed to make codec context from paramers for stream #%u in file '%s'\n", stream_index, path);
-        avformat_close_input(&format);
-        avcodec_free_context(&codec_context);
-        return -1;
-    }
-
-    codec_context->get_format = get_hw_format;
-
-    AVBufferRef *hw_device_ctx = NULL;
-    int hw_init_err = av_hwdevice_ctx_create(&hw_device_ctx, hwconfig->device_type, NULL, NULL, 0);
-    if (hw_init_err < 0) {
-        fprintf(stderr, "Failed to create hwdevice context for stream #%u in file '%s'\n", stream_index, path);
-        return -1;
+    AVCodecContext* codec_context = open_video_decoder(
+                video_codec, format->streams[stream_index]->codecpar, hw_device_ctx, &hw_pix_fmt);
+    if (!codec_context && hw_device_ctx != NULL) {
+        fprintf(stderr, "Failed to open hardware decoder for stream #%u in file '%s', decoding in software\n", stream_index, path);
+        av_buffer_unref(&hw_device_ctx);
+        hw_pix_fmt = AV_PIX_FMT_NONE;
+        codec_context = open_video_decoder(
+                    video_codec, format->streams[stream_index]->codecpar, NULL, &hw_pix_fmt);
     }
-
-    codec_context->hw_device_ctx = av_buffer_ref(hw_device_ctx);
-
-    if (avcodec_open2(codec_context, video_codec, NULL) < 0) {
+    if (!codec_context) {
         fprintf(stderr, "Failed to open decoder for stream #%u in file '%s'\n", stream_index, path);
-        av_buffer_unref(&hw_device_ctx);
-        avformat_close_input(&format);
-        avcodec_free_context(&codec_context);
         return -1;
     }
 
@@ -272,7 +563,9 @@ int get_video_frames(Image **images, const char* path, double start, double end,
     const float aspect_ratio = (float)format->streams[stream_index]->codecpar->width / format->streams[stream_index]->codecpar->height;
     const int dst_height = height;
     const int dst_width = height * aspect_ratio;
-    const AVPixelFormat dst_format = AV_PIX_FMT_RGB24;
+    // native-endian 0xAARRGGBB, the layout of QImage::Format_RGB32, so that the frames can be
+    // scaled straight into the images, and the images drawn without converting them
+    const AVPixelFormat dst_format = AV_PIX_FMT_RGB32;
     SwsContext *sws = NULL;
 
     // prepare to read data
@@ -282,7 +575,6 @@ int get_video_frames(Image **images, const char* path, double start, double end,
     AVFrame* swframe = av_frame_alloc();
     if (!frame || !swframe) {
         fprintf(stderr, "Error allocating the frame\n");
-        avformat_close_input(&format);
         avcodec_free_context(&codec_context);
         sws_freeContext(sws);
         return -1;
@@ -290,132 +582,114 @@ int get_video_frames(Image **images, const char* path, double start, double end,
     packet.data = NULL;
     packet.size = 0;
 
-    // allocate frame for output
-    AVFrame *output_frame = av_frame_alloc();
-    output_frame->format = dst_format;
-    output_frame->width = dst_width;
-    output_frame->height = dst_height;
-    int output_frame_buffer = av_frame_get_buffer(output_frame, 0);
-    if (output_frame_buffer < 0) {
-        fprintf(stderr, "Failed allocate frame buffer for stream #%u in file '%s'\n", stream_index, path);
-        char *err = (char *)malloc(sizeof(char) * 500);
-        av_strerror(output_frame_buffer, err, 500);
-        std::cout << err << std::endl;
-        free(err);
-        avformat_close_input(&format);
-        avcodec_free_context(&codec_context);
-        sws_freeContext(sws);
-        return -1;
+    AVStream* stream = format->streams[stream_index];
+    // when exact timing isn't needed, only keyframes are decoded at all
+    if (!exact) {
+        codec_context->skip_frame = AVDISCARD_NONKEY;
     }
-
-    const int output_size = sizeof(uint8_t) * 3 * dst_width * dst_height;
-    int seek_ts = (int)std::round(start * format->streams[stream_index]->time_base.den / format->streams[stream_index]->time_base.num);
-    av_seek_frame(format, stream_index, seek_ts, AVSEEK_FLAG_BACKWARD);
-    *images = (Image*)malloc(sizeof(Image) * count);
+    images->clear();
     int current_idx = 0;
     float next_time = start;
     float delta_time = (end - start)/double(count - 1);
-    while (av_read_frame(format, &packet) >= 0) {
+    // the thumbnails are taken in increasing time, so after each one the decoder either goes on
+    // from where it is, or seeks if the next one is past another keyframe anyway
+    int64_t target_ts = seek_to_thumbnail(format, stream, seconds_to_ts(stream, next_time), exact);
+    bool done = false;
+    while (!done && av_read_frame(format, &packet) >= 0) {
         if (packet.stream_index != stream_index) {
             av_packet_unref(&packet);
             continue;
         }
 
-        // decode one frame
+        // decode the packet
         int ret = avcodec_send_packet(codec_context, &packet);
+        av_packet_unref(&packet);
         if (ret < 0) {
-            av_packet_unref(&packet);
             fprintf(stderr, "Failed to send packet for stream #%u in file '%s'\n", stream_index, path);
             break;
         }
 
-        ret = avcodec_receive_frame(codec_context, frame);
+        while (!done && (ret = avcodec_receive_frame(codec_context, frame)) == 0) {
+            const int64_t pts = frame->best_effort_timestamp;
+            if (exact && pts != AV_NOPTS_VALUE && pts < target_ts) {
+                continue;
+            }
 
-        if (ret == AVERROR(EAGAIN)) {
-            av_packet_unref(&packet);
-            continue;
-        }
-        if (ret != 0) {
-            char *err = (char *)malloc(sizeof(char) * 500);
-            av_strerror(output_frame_buffer, err, 500);
-            std::cout << err << std::endl;
-            free(err);
-            av_packet_unref(&packet);
-            break;
-        }
-        double t = (double)frame->pts * format->streams[stream_index]->time_base.num / format->streams[stream_index]->time_base.den;
-        if (t < next_time) {
-            av_packet_unref(&packet);
-            continue;
-        }
+            AVFrame* source = frame;
+            if (hw_device_ctx != NULL && frame->format == hw_pix_fmt) {
+                ret = av_hwframe_transfer_data(swframe, frame, 0);
+                if (ret < 0) {
+                    fprintf(stderr, "Error transferring date to system memory\n");
+                    done = true;
+                    break;
+                }
+                source = swframe;
+            }
 
-        if (frame->format == hwconfig->pix_fmt) {
-            ret = av_hwframe_transfer_data(swframe, frame, 0);
-            if (ret < 0) {
-                av_packet_unref(&packet);
-                fprintf(stderr, "Error transferring date to system memory\n");
+            sws = sws_getCachedContext(
+                        sws,
+                        stream->codecpar->width,
+                        stream->codecpar->height,
+                        AVPixelFormat(source->format),
+                        dst_width,
+                        dst_height,
+                        dst_format,
+                        SWS_BILINEAR,
+                        NULL,
+                        NULL,
+                        NULL
+                        );
+            if (sws == NULL) {
+                fprintf(stderr, "Could not create sws context\n");
+                done = true;
                 break;
             }
-        }
 
-        sws = sws_getCachedContext(
-                    sws,
-                    format->streams[stream_index]->codecpar->width,
-                    format->streams[stream_index]->codecpar->height,
-                    AVPixelFormat(swframe->format),
-                    /*AVPixelFormat(format->streams[stream_index]->codecpar->format) hwconfig->pix_fmt*/
-                    dst_width,
-                    dst_height,
-                    dst_format,
-                    SWS_BILINEAR,
-                    NULL,
-                    NULL,
-                    NULL
-                    );
-        if (sws == NULL) {
-            fprintf(stderr, "Could not create sws context\n");
-            av_packet_unref(&packet);
-            break;
-        }
-
-        sws_scale(sws, swframe->data, swframe->linesize, 0, swframe->height, output_frame->data, output_frame->linesize);
-        const int linesize = output_frame->linesize[0];
+            QImage thumbnail(dst_width, dst_height, QImage::Format_RGB32);
+            uint8_t *dst_data[4] = { thumbnail.bits(), NULL, NULL, NULL };
+            int dst_linesize[4] = { thumbnail.bytesPerLine(), 0, 0, 0 };
+            sws_scale(sws, source->data, source->linesize, 0, source->height, dst_data, dst_linesize);
+            images->push_back({ thumbnail, current_idx });
+            current_idx++;
+
+            // the next thumbnails may be the same keyframe again, which share the image
+            while (!exact && current_idx < count &&
+                   nearest_keyframe(stream, seconds_to_ts(stream, start + current_idx * delta_time)) == target_ts) {
+                images->push_back({ thumbnail, current_idx });
+                current_idx++;
+            }
+            if (current_idx >= count) {
+                done = true;
+                break;
+            }
 
-        uint8_t *data = (uint8_t*)malloc(output_size);
-        uint8_t *p = data;
-        for (int y = 0; y < dst_height; ++y) {
-            memcpy(p, output_frame->data[0] + (y*linesize), dst_width*3);
-            p += dst_width*3;
+            next_time = start + current_idx * delta_time;
+            target_ts = seconds_to_ts(stream, next_time);
+            // decoding on is cheaper than seeking as long as no keyframe lies in between
+            const int64_t keyframe = keyframe_before(stream, target_ts);
+            const bool decode_on = exact && keyframe != AV_NOPTS_VALUE && pts != AV_NOPTS_VALUE && keyframe <= pts;
+            if (!decode_on) {
+                target_ts = seek_to_thumbnail(format, stream, target_ts, exact);
+                avcodec_flush_buffers(codec_context);
+                break;
+            }
         }
-        av_packet_unref(&packet);
-        (*images)[current_idx] = {
-            data,
-            output_size,
-            dst_width,
-            dst_height,
-            current_idx
-        };
-        current_idx++;
-        if (current_idx >= count) {
+        if (ret != 0 && ret != AVERROR(EAGAIN)) {
+            char *err = (char *)malloc(sizeof(char) * 500);
+            av_strerror(ret, err, 500);
+            std::cout << err << std::endl;
+            free(err);
             break;
         }
-
-        next_time = start + current_idx * delta_time;
-        seek_ts = (int)std::round(next_time * format->streams[stream_index]->time_base.den / format->streams[stream_index]->time_base.num);
-        av_seek_frame(format, stream_index, seek_ts, AVSEEK_FLAG_BACKWARD);
-        avcodec_flush_buffers(codec_context);
     }
 
     // clean up
     av_buffer_unref(&hw_device_ctx);
-    avformat_close_input(&format);
     av_frame_free(&frame);
     av_frame_free(&swframe);
-    av_frame_free(&output_frame);
     sws_freeContext(sws);
     avcodec_close(codec_context);
     avcodec_free_context(&codec_context);
-    avformat_free_context(format);
 
     // success
     return 0;
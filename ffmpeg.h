@@ -2,9 +2,63 @@
 #define FFMPEG_H
 
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 #include "videolistitem.h"
 
+struct AVCodec;
+struct AVFormatContext;
+struct AVIOContext;
+class ReadAheadFile;
+
+// An open and probed media file, shared by everything that reads from it (the audio decode and
+// every thumbnail request), so the file is only opened and probed once. Since the format context
+// is kept, so is everything the demuxer learns while reading, like the keyframe index of the
+// streams, which makes later seeks cheaper too.
+// Files are read with a ReadAheadFile, so that the demuxer's small reads don't each wait for the
+// disk or the network.
+// A format context can only be used by one thread at a time: lock the mutex while using it. The
+// audio decode holds it for the whole decode, so the thumbnails don't wait for it: if the session
+// is busy, they open a private one instead (see get_video_frames).
+struct MediaSession {
+    std::string path;
+    AVFormatContext* format;
+    // the I/O of the format context, if it reads from a ReadAheadFile
+    AVIOContext* io;
+    ReadAheadFile* file;
+    // the best streams of each type and their decoders, the index is negative if there is none
+    int audio_stream_index;
+    AVCodec* audio_codec;
+    int video_stream_index;
+    AVCodec* video_codec;
+    std::mutex mutex;
+
+    ~MediaSession();
+};
+
+// Returns the session of the file, opening it if it isn't open yet, or nullptr if it can't be
+// opened. The most recently used sessions are kept open, and the rest are closed as soon as
+// nobody holds them anymore.
+std::shared_ptr<MediaSession> acquire_media_session(const char* path);
+
+// Receives the resampled mono samples of decode_audio_stream block by block, as soon as each one
+// has been decoded. The samples are only valid during the call. Returning false stops decoding.
+typedef std::function<bool(const float* samples, int count)> AudioBlockConsumer;
+
+// Decodes the window [start, start+duration) of the first audio stream of the file, resampled to
+// mono float at sample_rate, and hands it to the consumer in blocks instead of collecting it, so
+// the caller can work on the first samples while the rest is still being decoded, and stop as soon
+// as it has enough. Returns 0 on success, including when the consumer stops early, -1 otherwise.
+int decode_audio_stream(const char* path, const int sample_rate, double start, double duration,
+                        const AudioBlockConsumer& consumer);
+// Same as decode_audio_stream, but collects the whole window into an array allocated with malloc.
 int decode_audio_file(const char* path, const int sample_rate, float** data, int* size, double start, double duration);
-int get_video_frames(Image **images, const char* path, double start, double end, int count, int height);
+// Extracts count evenly spaced frames between start and end, scaled to the given height. If exact is
+// false, the keyframe closest to each time is taken instead, which only decodes keyframes.
+int get_video_frames(std::vector<Image> *images, const char* path, double start, double end, int count, int height,
+                     bool exact = true);
 
 #endif // FFMPEG_H
@@ -1,39 +1,170 @@
 #include "findsound.h"
+#include "audiocache.h"
 #include "ffmpeg.h"
 #include "execution_timer.h"
-#include <QThreadPool>
+#include "taskscheduler.h"
 #include <QObject>
+#include <functional>
+#include <memory>
+#include <numeric>
 #include <unordered_map>
 
+// the coarse search of bestPatchPosition runs at 64 Hz
+#define PYRAMID_FACTOR 16
+// how many places found by the coarse search are looked at closely
+#define PYRAMID_CANDIDATES 4
+// how far around every one of them, in samples of the full rate
+#define PYRAMID_MARGIN (SAMPLE_RATE / 2)
+// how much of the middle of the patch, in seconds, is correlated there
+#define PYRAMID_EXCERPT 8
+// shorter patches, in seconds, are searched at the full rate only
+#define PYRAMID_MIN_PATCH 16
+// the files of a pass are matched this many per thread at a time, so that a candidate intro that
+// fits none of them is given up on without matching it against the whole season
+#define MATCH_BLOCK_PER_THREAD 4
+
 void LoadSoundDataTask::run()
 {
-    QByteArray ba = this->path.toLocal8Bit();
-    FloatSignal *signal = FindSound::getWavData(ba.constData(), SOURCE_START, SOURCE_END);
+    // files seen in an earlier session skip ffmpeg entirely
+    FloatSignal *signal = AudioCache::load(this->path, SAMPLE_RATE, SOURCE_START, SOURCE_END);
+    if (signal == nullptr) {
+        QByteArray ba = this->path.toLocal8Bit();
+        signal = FindSound::getWavData(ba.constData(), SOURCE_START, SOURCE_END);
+        AudioCache::store(this->path, SAMPLE_RATE, SOURCE_START, SOURCE_END, signal);
+    }
     FileSignal result = {
         signal,
-        this->path
+        this->path,
+        new AudioFingerprint(*signal, SAMPLE_RATE)
     };
 
     emit sendSoundData(result);
 }
 
+// Where the intro is in a file, and how close that part of the file is to it.
+struct IntroMatch {
+    float startTime;
+    float endTime;
+    CorrelateResult howClose;
+};
+
+static IntroMatch matchIntro(const FileSignal &fileSignal, const IntroInfo &introInfo,
+                             const std::vector<Landmark> &introLandmarks)
+{
+    // the fingerprint finds the intro with a few lookups; the whole cross-correlation is
+    // only needed when it is too quiet or too short to have enough landmarks
+    FingerprintMatch match;
+    float startTime;
+    if (fileSignal.fingerprint->bestMatch(introLandmarks, &match)) {
+        startTime = fileSignal.fingerprint->frameToSeconds(match.offset);
+    } else {
+        startTime = FindSound::bestPatchPosition(*fileSignal.signal, introInfo.intro).timestamp;
+    }
+    const float endTime = startTime + introInfo.endTime - introInfo.startTime;
+    const SignalView otherIntro = FindSound::signalSlice(
+                fileSignal.signal, startTime, endTime);
+    const IntroMatch result = {
+        startTime,
+        endTime,
+        FindSound::howCloseAreSignals(otherIntro, introInfo.intro)
+    };
+
+    return result;
+}
+
 void FindSoundTask::run()
 {
     std::vector<FileSignal> rest = fileSignals;
-    std::unordered_map<QString, float> bestMatches;
-    int badStreak = 0;
+    // the intros found before go first, so that only the files none of them fits need a search
+    for (const KnownIntro &knownIntro : knownIntros) {
+        if (rest.empty()) {
+            break;
+        }
+        OpenMpThreadReservation threads;
+        IntroInfo introInfo;
+        introInfo.startTime = knownIntro.startTime;
+        introInfo.endTime = knownIntro.endTime;
+        introInfo.matchPercent = 1.0f;
+        introInfo.intro = FindSound::signalSlice(
+                    knownIntro.source.signal, knownIntro.startTime, knownIntro.endTime);
+        rest = matchIntroPass(introInfo, knownIntro.source, threads.threadCount());
+    }
+
     int lastBestIntroIdx = 0;
-    while (rest.size() > 1) {
-        badStreak = 0;
+    while (discover && rest.size() > 1) {
+        // taken again on every pass, so that the cores freed by files finishing to load get used
+        OpenMpThreadReservation threads;
         IntroInfo introInfo;
         lastBestIntroIdx = FindSound::nextBestIntro(rest, &introInfo, lastBestIntroIdx);
         if (lastBestIntroIdx < 0) {
             break;
         }
 
-        FloatSignal *intro = introInfo.intro;
-        rest.clear();
-        for (size_t i = 0; i < fileSignals.size(); ++i) {
+        const FileSignal source = rest[lastBestIntroIdx];
+        const KnownIntro knownIntro = {
+            source,
+            introInfo.startTime,
+            introInfo.endTime
+        };
+        emit sendKnownIntro(knownIntro);
+        rest = matchIntroPass(introInfo, source, threads.threadCount());
+    }
+
+    if (!discover) {
+        std::vector<size_t> unmatched;
+        for (auto &fileSignal : rest) {
+            for (size_t i = 0; i < fileSignals.size(); ++i) {
+                if (fileSignals[i].file == fileSignal.file) {
+                    unmatched.push_back(indices[i]);
+                    break;
+                }
+            }
+        }
+        emit sendUnmatched(unmatched);
+        return;
+    }
+
+    for (size_t i = 0; i < rest.size(); ++i) {
+        FindSoundResult result;
+        result.isProgress = true;
+        result.isBetter = false;
+        emit sendFindResult(result);
+    }
+}
+
+std::vector<FileSignal> FindSoundTask::matchIntroPass(const IntroInfo &introInfo,
+                                                      const FileSignal &source, int threadCount)
+{
+    const std::vector<Landmark> introLandmarks = source.fingerprint->landmarksBetween(
+                introInfo.startTime, introInfo.endTime);
+
+    // matching the intro is independent from file to file, so it's done for a block of files at
+    // once, every thread taking the next file as soon as it is done with one. What is done with
+    // the matches depends on the ones before, so they are gone through in order after, and the
+    // next block is only matched if the intro hasn't been given up on.
+    std::vector<char> wanted(fileSignals.size());
+    for (size_t i = 0; i < fileSignals.size(); ++i) {
+        auto bestIt = bestMatches.find(fileSignals[i].file);
+        wanted[i] = bestIt == bestMatches.end() || bestIt->second < 0.9;
+    }
+    const size_t blockSize = (size_t)std::max(threadCount, 1) * MATCH_BLOCK_PER_THREAD;
+    std::vector<IntroMatch> matches(fileSignals.size());
+
+    std::vector<FileSignal> rest;
+    int badStreak = 0;
+    bool gaveUp = false;
+    for (size_t blockStart = 0; blockStart < fileSignals.size() && !gaveUp; blockStart += blockSize) {
+        const size_t blockEnd = std::min(blockStart + blockSize, fileSignals.size());
+#ifdef WITH_OPENMP_ABOVE
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+        for (long long i = (long long)blockStart; i < (long long)blockEnd; ++i) {
+            if (wanted[i]) {
+                matches[i] = matchIntro(fileSignals[i], introInfo, introLandmarks);
+            }
+        }
+
+        for (size_t i = blockStart; i < blockEnd; ++i) {
             FileSignal &fileSignal = fileSignals[i];
             auto bestIt = bestMatches.find(fileSignal.file);
             float bestValue = bestIt == bestMatches.end() ? 0 : bestIt->second;
@@ -41,14 +172,9 @@ void FindSoundTask::run()
                 continue;
             }
 
-            CorrelateResult find = FindSound::bestPatchPosition(
-                        fileSignal.signal, intro);
-            const float startTime = find.timestamp;
-            const float endTime = startTime + introInfo.endTime - introInfo.startTime;
-            FloatSignal *otherIntro = FindSound::signalSlice(
-                        fileSignal.signal, startTime, endTime);
-            CorrelateResult howClose = FindSound::howCloseAreSignals(otherIntro, intro);
-            delete otherIntro;
+            const float startTime = matches[i].startTime;
+            const float endTime = matches[i].endTime;
+            const CorrelateResult howClose = matches[i].howClose;
 
             bool isBetter = false;
             bool isProgress = false;
@@ -64,10 +190,10 @@ void FindSoundTask::run()
                 rest.push_back(fileSignal);
             }
 
-            const bool isSourceOfIntro = fileSignal.file == fileSignals[lastBestIntroIdx].file;
+            const bool isSourceOfIntro = fileSignal.file == source.file;
             const FindSoundResult result = {
                 fileSignal.file,
-                i,
+                indices[i],
                 {
                     startTime,
                     endTime,
@@ -97,19 +223,29 @@ void FindSoundTask::run()
                         rest.push_back(fileSignal);
                     }
                 }
+                gaveUp = true;
                 break;
             }
         }
-
-        delete introInfo.intro;
     }
 
-    for (size_t i = 0; i < rest.size(); ++i) {
-        FindSoundResult result;
-        result.isProgress = true;
-        result.isBetter = false;
-        emit sendFindResult(result);
+    return rest;
+}
+
+void ClusterIntrosTask::run()
+{
+    OpenMpThreadReservation threads;
+    IntroClusters introClusters = FindSound::clusterByIntro(fileSignals);
+    for (auto &cluster : introClusters.clusters) {
+        for (size_t &index : cluster) {
+            index = indices[index];
+        }
+    }
+    for (size_t &index : introClusters.unclustered) {
+        index = indices[index];
     }
+
+    emit sendIntroClusters(introClusters);
 }
 
 FindSound::FindSound()
@@ -121,29 +257,101 @@ FindSound::~FindSound()
 {
     for (auto &fileSignal : this->fileSignals) {
         delete fileSignal.signal;
+        delete fileSignal.fingerprint;
+    }
+}
+
+int FindSound::run(SearchMode mode)
+{
+    searchMode = mode;
+    // files that an earlier search already found the intro of are left as they are
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < fileSignals.size(); ++i) {
+        auto bestIt = bestMatches.find(fileSignals[i].file);
+        if (bestIt == bestMatches.end() || bestIt->second < ACCEPTANCE_THRESHOLD) {
+            pending.push_back(i);
+        }
+    }
+    if (pending.empty()) {
+        return 0;
+    }
+
+    // the rest are matched against the intros found so far, and only the ones that none of them
+    // fits are searched for new intros
+    if (knownIntros.empty()) {
+        discoverIntros(pending);
+    } else {
+        startSearch(pending, knownIntros, false);
     }
+
+    return (int)pending.size();
 }
 
-int FindSound::run()
+void FindSound::discoverIntros(const std::vector<size_t> &indices)
+{
+    if (searchMode == SeasonClusters) {
+        ClusterIntrosTask *task = new ClusterIntrosTask();
+        for (size_t index : indices) {
+            task->fileSignals.push_back(fileSignals[index]);
+        }
+        task->indices = indices;
+        QObject::connect(task, &ClusterIntrosTask::sendIntroClusters,
+                         this, &FindSound::receiveIntroClusters);
+        TaskScheduler::start(task, TaskScheduler::SearchPriority);
+    } else {
+        startSearch(indices, std::vector<KnownIntro>(), true);
+    }
+}
+
+void FindSound::startSearch(const std::vector<size_t> &indices,
+                            const std::vector<KnownIntro> &intros, bool discover)
 {
     FindSoundTask *task = new FindSoundTask();
-    task->fileSignals = fileSignals;
+    for (size_t index : indices) {
+        const FileSignal &fileSignal = fileSignals[index];
+        task->fileSignals.push_back(fileSignal);
+        auto bestIt = bestMatches.find(fileSignal.file);
+        if (bestIt != bestMatches.end()) {
+            task->bestMatches[fileSignal.file] = bestIt->second;
+        }
+    }
+    task->indices = indices;
+    task->knownIntros = intros;
+    task->discover = discover;
     QObject::connect(task, &FindSoundTask::sendFindResult, this, &FindSound::receiveFindSoundResult);
-    QThreadPool::globalInstance()->start(task);
+    QObject::connect(task, &FindSoundTask::sendKnownIntro, this, &FindSound::receiveKnownIntro);
+    QObject::connect(task, &FindSoundTask::sendUnmatched, this, &FindSound::discoverIntros);
+    TaskScheduler::start(task, TaskScheduler::SearchPriority);
+}
 
-    return (int)fileSignals.size();
+void FindSound::receiveIntroClusters(IntroClusters introClusters)
+{
+    // every cluster is searched by a task of its own, so they run side by side; the files left
+    // out still get the usual search among themselves, and their progress reported
+    for (auto &cluster : introClusters.clusters) {
+        startSearch(cluster, std::vector<KnownIntro>(), true);
+    }
+    if (!introClusters.unclustered.empty()) {
+        startSearch(introClusters.unclustered, std::vector<KnownIntro>(), true);
+    }
+}
+
+void FindSound::receiveKnownIntro(KnownIntro knownIntro)
+{
+    knownIntros.push_back(knownIntro);
 }
 
 void FindSound::addFiles(std::vector<QString> filepaths)
 {
-    this->filepaths.insert(this->filepaths.begin(), filepaths.begin(), filepaths.end());
+    // appended, like the items of the list, so that the indices of the files already there stay
+    this->filepaths.insert(this->filepaths.end(), filepaths.begin(), filepaths.end());
     this->fileSignals.resize(this->filepaths.size());
     for (auto &filepath : filepaths) {
         LoadSoundDataTask *task = new LoadSoundDataTask();
         task->path = filepath;
         QObject::connect(task, &LoadSoundDataTask::sendSoundData,
                          this, &FindSound::receiveSoundData);
-        QThreadPool::globalInstance()->start(task);
+        TaskScheduler::start(task, TaskScheduler::IngestPriority);
     }
 }
 
@@ -173,108 +381,192 @@ void FindSound::receiveFindSoundResult(FindSoundResult findSoundResult)
     }
 
     if (findSoundResult.isBetter) {
+        // kept for the next searches, see run
+        bestMatches[findSoundResult.file] = findSoundResult.introInfo.matchPercent;
         emit sendFindSoundResult(findSoundResult);
     }
 }
 
 FloatSignal* FindSound::getWavData(const char* path, double start, double duration)
 {
-    float* data;
-    int size;
+    float* data = nullptr;
+    int size = 0;
+
+    if (decode_audio_file(path, SAMPLE_RATE, &data, &size, start, duration) != 0 || data == nullptr) {
+        free(data);
+        return new FloatSignal(0);
+    }
+    // take over the decoded buffer instead of copying it
+    FloatSignal *result = FloatSignal::Wrap(data, size, std::shared_ptr<float>(data, free));
+    result->makeAligned();
+
+    return result;
+}
 
-    decode_audio_file(path, SAMPLE_RATE, &data, &size, start, duration);
-    FloatSignal *result = new FloatSignal(data, size);
-    free(data);
+// Turns the peak of a cross-correlation into the position of the patch in the source. The peaks
+// are searched from len(patch) on, so lags where the patch starts before the source are skipped.
+static CorrelateResult correlateResultFromPeak(const XcorrPeak &peak, const size_t patchSize)
+{
+    const size_t sampleIdx = peak.value > 0 ? peak.index - patchSize : 0;
+    CorrelateResult result = {
+        sampleIdx, peak.value, (float)sampleIdx / SAMPLE_RATE };
 
     return result;
 }
 
-CorrelateResult FindSound::bestPatchPosition(FloatSignal* source, FloatSignal* patch)
+// Same as correlateResultFromPeak, for a peak indexed by lag. Lag s is where the xcorr index
+// s+len(patch)-1 is, so it maps to sample s-1.
+static CorrelateResult correlateResultFromLag(const XcorrPeak &peak)
 {
-    assert(source->getSize() >= patch->getSize());
+    const size_t sampleIdx = peak.value > 0 ? peak.index - 1 : 0;
+    CorrelateResult result = {
+        sampleIdx, peak.value, (float)sampleIdx / SAMPLE_RATE };
 
-    OverlapSaveConvolver x(*source, *patch);
-    x.executeXcorr();
-    FloatSignal *xcorr = x.extractResult();
+    return result;
+}
 
-    const float* data = xcorr->getData();
-    float max = 0;
-    size_t maxIdx = 0;
-    const size_t patchSize = patch->getSize();
-    const size_t xcorrSize = xcorr->getSize();
-    for (size_t i = patchSize; i < xcorrSize; ++i) {
-        const float f = data[i];
-        if (f > max) {
-            max = f;
-            maxIdx = i - patchSize;
+// Looks for the patch in the loudness envelopes of both signals first, which are PYRAMID_FACTOR
+// times shorter, and then at the full rate only around the best few places found there. The full
+// rate pass only needs to settle a fraction of a second, so it correlates an excerpt of the patch
+// instead of all of it. Returns false if nothing correlates, so the full search has to be done.
+bool FindSound::coarseToFinePatchPosition(const SignalView &source, const SignalView &patch,
+                                          CorrelateResult *result)
+{
+    std::unique_ptr<FloatSignal> coarseSource(DecimatedEnvelope(source, PYRAMID_FACTOR));
+    std::unique_ptr<FloatSignal> coarsePatch(DecimatedEnvelope(patch, PYRAMID_FACTOR));
+    const size_t coarsePatchSize = coarsePatch->getSize();
+    std::vector<XcorrPeak> candidates;
+    {
+        OverlapSaveConvolver coarse(*coarseSource, *coarsePatch);
+        // the candidates are at least a second apart
+        candidates = coarse.executeXcorrPeaks(PYRAMID_CANDIDATES, SAMPLE_RATE / PYRAMID_FACTOR,
+                                              coarsePatchSize, coarse.getResultSize());
+    }
+
+    const size_t patchSize = patch.getSize();
+    const size_t excerptSize = std::min(patchSize, (size_t)(PYRAMID_EXCERPT * SAMPLE_RATE));
+    const size_t excerptStart = (patchSize - excerptSize) / 2;
+    const SignalView excerpt = patch.slice(excerptStart, excerptSize);
+    float bestValue = 0;
+    size_t bestIdx = 0;
+    for (const XcorrPeak &candidate : candidates) {
+        // where the excerpt would be, with the same convention as correlateResultFromPeak
+        const size_t start = (candidate.index - coarsePatchSize) * PYRAMID_FACTOR + excerptStart;
+        const size_t sliceStart = start > PYRAMID_MARGIN ? start - PYRAMID_MARGIN : 0;
+        const size_t sliceEnd = std::min(start + excerptSize + PYRAMID_MARGIN, source.getSize());
+        if (sliceEnd < sliceStart + excerptSize) {
+            continue;
         }
+        OverlapSaveConvolver fine(source.slice(sliceStart, sliceEnd - sliceStart), excerpt);
+        const XcorrPeak peak = fine.executeXcorrPeak(excerptSize, fine.getResultSize());
+        const size_t excerptIdx = sliceStart + peak.index - excerptSize;
+        if (peak.value > bestValue && excerptIdx >= excerptStart) {
+            bestValue = peak.value;
+            bestIdx = excerptIdx - excerptStart;
+        }
+    }
+    if (bestValue <= 0) {
+        return false;
     }
 
-    CorrelateResult result = {
-        maxIdx, max, (float)maxIdx / SAMPLE_RATE };
-    delete xcorr;
+    // the value of the whole patch there, as the full cross-correlation would have it
+    double value = 0;
+    for (size_t i = 0; i < patchSize; ++i) {
+        value += (double)patch[i] * source[bestIdx + 1 + i];
+    }
+    result->sampleIdx = bestIdx;
+    result->value = (float)value;
+    result->timestamp = (float)bestIdx / SAMPLE_RATE;
 
-    return result;
+    return true;
+}
+
+CorrelateResult FindSound::bestPatchPosition(const SignalView &source, const SignalView &patch)
+{
+    assert(source.getSize() >= patch.getSize());
+
+    // an intro long enough has plenty of envelope to be found by, which saves correlating it
+    // against the whole source at the full rate
+    CorrelateResult coarseToFine;
+    if (patch.getSize() >= PYRAMID_MIN_PATCH * SAMPLE_RATE
+            && coarseToFinePatchPosition(source, patch, &coarseToFine)) {
+        return coarseToFine;
+    }
+
+    OverlapSaveConvolver x(source, patch);
+    const XcorrPeak peak = x.executeXcorrPeak(patch.getSize(), x.getResultSize());
+
+    return correlateResultFromPeak(peak, patch.getSize());
+}
+
+CorrelateResult FindSound::bestPatchPosition(const PreparedSignal* source, const SignalView &patch)
+{
+    assert(source->getGeometry().patch_size == patch.getSize());
+
+    OverlapSaveConvolver x(*source, patch);
+    const XcorrPeak peak = x.executeXcorrPeak(patch.getSize(), x.getResultSize());
+
+    return correlateResultFromPeak(peak, patch.getSize());
 }
 
-CorrelateResult FindSound::howCloseAreSignals(FloatSignal* one, FloatSignal* two)
+std::vector<CorrelateResult> FindSound::bestPatchPositions(const PreparedSignal* source,
+                                                          const std::vector<SignalView> &patches)
+{
+    const OverlapSaveGeometry &geometry = source->getGeometry();
+    const size_t patchSize = geometry.patch_size;
+    std::vector<XcorrPeak> peaks = BatchXcorrPeaks(*source, patches, patchSize, geometry.result_size);
+
+    std::vector<CorrelateResult> results(peaks.size());
+    for (size_t i = 0; i < peaks.size(); ++i) {
+        results[i] = correlateResultFromPeak(peaks[i], patchSize);
+    }
+
+    return results;
+}
+
+CorrelateResult FindSound::howCloseAreSignals(const SignalView &one, const SignalView &two)
 {
     // ExecutionTimer timer("howCloseAreSignals");
 
-    size_t size = std::min(one->getSize(), two->getSize());
-    FloatSignal* a = new FloatSignal(one->getData(), size);
-    FloatSignal* b = new FloatSignal(two->getData(), size);
-    assert(a->getSize() == b->getSize() && a->getSize() == size);
-    *a -= a->mean();
-    *a /= (a->std() * size);
-    *b -= b->mean();
-    *b /= b->std();
-
-    CorrelateResult resultA = bestPatchPosition(a, b);
-    delete a;
-    delete b;
-
-    a = new FloatSignal(two->getData(), size);
-    b = new FloatSignal(one->getData(), size);
-    assert(a->getSize() == b->getSize() && a->getSize() == size);
-    *a -= a->mean();
-    *a /= (a->std() * size);
-    *b -= b->mean();
-    *b /= b->std();
-
-    CorrelateResult resultB = bestPatchPosition(a, b);
-    delete a;
-    delete b;
+    const NccResult ncc = normalizedCrossCorrelation(one, two);
 
     CorrelateResult result;
-    if (resultA.value > resultB.value) {
-        result = resultA;
+    if (ncc.twoInOne.value > ncc.oneInTwo.value) {
+        result = ncc.twoInOne;
     } else {
-        result = resultB;
+        result = ncc.oneInTwo;
     }
 
    return result;
 }
 
-FloatSignal* FindSound::signalSlice(FloatSignal* signal, float start, float end) {
+// Finds where two best fits inside one, and where one best fits inside two, both with the same
+// search range and result convention as bestPatchPosition(one, two) and bestPatchPosition(two, one)
+// on the z-scored signals, with the values normalized by their common length.
+NccResult FindSound::normalizedCrossCorrelation(const SignalView &one, const SignalView &two)
+{
+    size_t size = std::min(one.getSize(), two.getSize());
+    XcorrPeak twoInOne;
+    XcorrPeak oneInTwo;
+    NormalizedCrossCorrelationPeaks(one.slice(0, size), two.slice(0, size), &twoInOne, &oneInTwo);
+
+    const NccResult result = {
+        correlateResultFromLag(twoInOne),
+        correlateResultFromLag(oneInTwo)
+    };
+
+    return result;
+}
+
+// NOTE: the slice is a view of the signal's data, so it must not outlive the signal. Whatever
+// part of it runs past the end of the signal reads as zeros.
+SignalView FindSound::signalSlice(const FloatSignal* signal, float start, float end) {
     size_t startSampleIdx = (size_t)(start * SAMPLE_RATE);
     size_t endSampleIdx = (size_t)(end * SAMPLE_RATE);
     size_t size = endSampleIdx - startSampleIdx;
-    float* data = signal->getData();
     assert(signal->getSize() > startSampleIdx);
-    if (signal->getSize() < startSampleIdx + size) {
-        float *newData = (float*)malloc(sizeof(float) * size);
-        memset(newData, 0, sizeof(float) * size);
-        memcpy(newData, data + startSampleIdx, sizeof(float) * (signal->getSize() - startSampleIdx));
 
-        FloatSignal* slice = new FloatSignal(newData, size);
-        free(newData);
-        return slice;
-    }
-
-    FloatSignal* slice = new FloatSignal(data + startSampleIdx, size);
-
-    return slice;
+    return SignalView(*signal).slice(startSampleIdx, size);
 }
 
 IntroChunkSearchResult
@@ -341,20 +633,19 @@ IntroChunkSearchResult
 FindSound::doChunkScan(FloatSignal* one, FloatSignal* two,
                        size_t patchStart, size_t patchEnd, int patchDuration) {
     assert(patchEnd > patchStart);
-    std::vector<FloatSignal*> patches;
+    std::vector<SignalView> patches;
     for (size_t i = patchStart; (i + patchDuration) < patchEnd &&
          i < SOURCE_END; i += patchDuration) {
         patches.push_back(FindSound::signalSlice(two, i, i + patchDuration));
     }
 
-    std::vector<CorrelateResult> results(patches.size());
-
-    for (size_t i = 0; i < results.size(); ++i) {
-        results[i] = bestPatchPosition(one, patches.at(i));
-    }
+    std::vector<CorrelateResult> results;
 
-    for (auto patch : patches) {
-        delete patch;
+    // every patch has the same length, so the chunks of the source only need to be transformed
+    // once, and all the patches can be correlated against it as one batch
+    if (!patches.empty()) {
+        const PreparedSignal preparedOne(*one, patches.front().getSize());
+        results = bestPatchPositions(&preparedOne, patches);
     }
 
     IntroChunkSearchResult scanResult = getChunkSearchResults(results, patchDuration);
@@ -362,32 +653,39 @@ FindSound::doChunkScan(FloatSignal* one, FloatSignal* two,
     return scanResult;
 }
 
-IntroInfo FindSound::getIntroFromPair(FloatSignal* one, FloatSignal* two) {
+IntroInfo FindSound::getIntroFromPair(const FileSignal &one, const FileSignal &two) {
     // ExecutionTimer timer("FindSound::getIntroFromPair");
-    const int patchDuration = 4;
-    IntroChunkSearchResult scanResult = doChunkScan(one, two, 0, SOURCE_END, patchDuration);
-    float startTime = scanResult.startTime;
-    float endTime = scanResult.endTime;
+    float startTime;
+    float endTime;
+    float twoStartTime;
+    FingerprintSegment segment;
+    if (one.fingerprint->commonSegment(*two.fingerprint, &segment)) {
+        startTime = segment.startTime;
+        endTime = segment.endTime;
+        twoStartTime = segment.otherStartTime;
+    } else {
+        const int patchDuration = 4;
+        IntroChunkSearchResult scanResult = doChunkScan(
+                    one.signal, two.signal, 0, SOURCE_END, patchDuration);
+        startTime = scanResult.startTime;
+        endTime = scanResult.endTime;
+        const SignalView introOne = FindSound::signalSlice(one.signal, startTime, endTime);
+        twoStartTime = FindSound::bestPatchPosition(*two.signal, introOne).timestamp;
+    }
     std::cout << "Intro start time: " << startTime
               << ", Intro end time: " << endTime << std::endl;
 
-    FloatSignal *introOne = FindSound::signalSlice(one, scanResult.startTime, scanResult.endTime);
-    CorrelateResult find = FindSound::bestPatchPosition(
-                        two, introOne);
-    const float twoStartTime = find.timestamp;
     const float twoEndTime = twoStartTime + endTime - startTime;
-    FloatSignal *introTwo = FindSound::signalSlice(
-                two, twoStartTime, twoEndTime);
+    const SignalView introOne = FindSound::signalSlice(one.signal, startTime, endTime);
+    const SignalView introTwo = FindSound::signalSlice(
+                two.signal, twoStartTime, twoEndTime);
     CorrelateResult howClose = howCloseAreSignals(introOne, introTwo);
 
-    delete introOne;
-    delete introTwo;
-
     const IntroInfo result = {
         startTime,
         endTime,
         howClose.value,
-        nullptr,
+        SignalView(),
         twoStartTime,
         twoEndTime
     };
@@ -398,16 +696,15 @@ IntroInfo FindSound::getIntroFromPair(FloatSignal* one, FloatSignal* two) {
 int FindSound::nextBestIntro(const std::vector<FileSignal> &fileSignals, IntroInfo *result, int start)
 {
     for (size_t i = start; i < fileSignals.size() - 1; ++i) {
-        IntroInfo introInfo = FindSound::getIntroFromPair(
-                    fileSignals[i].signal, fileSignals[i+1].signal);
+        IntroInfo introInfo = FindSound::getIntroFromPair(fileSignals[i], fileSignals[i+1]);
 
-        const int minLength = 20;
+        const int minLength = MIN_INTRO_LENGTH;
         const bool tooCloseToEnd = introInfo.endTime >= (SOURCE_END - minLength)
                 || introInfo.otherEndTime >= (SOURCE_END - minLength);
         const bool tooShort = (introInfo.endTime - introInfo.startTime) <= minLength;
 
         if (introInfo.matchPercent >= ACCEPTANCE_THRESHOLD && !tooCloseToEnd && !tooShort) {
-            FloatSignal *intro = FindSound::signalSlice(
+            const SignalView intro = FindSound::signalSlice(
                         fileSignals[i].signal, introInfo.startTime, introInfo.endTime);
             introInfo.intro = intro;
             *result = introInfo;
@@ -417,3 +714,132 @@ int FindSound::nextBestIntro(const std::vector<FileSignal> &fileSignals, IntroIn
 
     return -1;
 }
+
+IntroClusters FindSound::clusterByIntro(const std::vector<FileSignal> &fileSignals)
+{
+    const size_t count = fileSignals.size();
+
+    // how many hashes every two files have in common, counted from an inverted index of them
+    std::vector<std::pair<uint32_t, uint32_t>> postings;
+    for (size_t i = 0; i < count; ++i) {
+        if (fileSignals[i].fingerprint == nullptr) {
+            continue;
+        }
+        for (uint32_t hash : fileSignals[i].fingerprint->distinctHashes()) {
+            postings.push_back(std::make_pair(hash, (uint32_t)i));
+        }
+    }
+    std::sort(postings.begin(), postings.end());
+    std::vector<int> shared(count * count, 0);
+    for (size_t start = 0, end = 0; start < postings.size(); start = end) {
+        while (end < postings.size() && postings[end].first == postings[start].first) {
+            end++;
+        }
+        // the files of a hash are in order, so only the upper triangle is filled
+        for (size_t a = start; a < end; ++a) {
+            for (size_t b = a + 1; b < end; ++b) {
+                shared[postings[a].second * count + postings[b].second]++;
+            }
+        }
+    }
+
+    // the files every file shares the most hashes with are checked with the fingerprints; sharing
+    // hashes only hints at a common part, the offsets of the landmarks have to agree as well
+    std::vector<std::pair<size_t, size_t>> candidates;
+    for (size_t i = 0; i < count; ++i) {
+        std::vector<std::pair<int, size_t>> others;
+        for (size_t j = 0; j < count; ++j) {
+            const int value = i < j ? shared[i * count + j] : shared[j * count + i];
+            if (j != i && value > 0) {
+                others.push_back(std::make_pair(value, j));
+            }
+        }
+        const size_t kept = std::min(others.size(), (size_t)CLUSTER_CANDIDATES);
+        std::partial_sort(others.begin(), others.begin() + kept, others.end(),
+                          std::greater<std::pair<int, size_t>>());
+        for (size_t k = 0; k < kept; ++k) {
+            candidates.push_back(std::make_pair(std::min(i, others[k].second),
+                                                std::max(i, others[k].second)));
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    std::vector<int> votes(candidates.size(), 0);
+#ifdef WITH_OPENMP_ABOVE
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int k = 0; k < (int)candidates.size(); ++k) {
+        const FileSignal &one = fileSignals[candidates[k].first];
+        const FileSignal &two = fileSignals[candidates[k].second];
+        FingerprintSegment segment;
+        if (one.fingerprint->commonSegment(*two.fingerprint, &segment)
+                && segment.endTime - segment.startTime > MIN_INTRO_LENGTH) {
+            votes[k] = segment.votes;
+        }
+    }
+
+    // the connected components of the files that share a part are the clusters
+    std::vector<size_t> parent(count);
+    std::iota(parent.begin(), parent.end(), 0);
+    auto root = [&parent](size_t i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    };
+    std::vector<int> edges(count, 0);
+    std::vector<int> bestVotes(count, 0);
+    std::vector<size_t> bestPartner(count, 0);
+    for (size_t k = 0; k < candidates.size(); ++k) {
+        if (votes[k] == 0) {
+            continue;
+        }
+        const size_t a = candidates[k].first;
+        const size_t b = candidates[k].second;
+        parent[root(a)] = root(b);
+        edges[a]++;
+        edges[b]++;
+        if (votes[k] > bestVotes[a]) {
+            bestVotes[a] = votes[k];
+            bestPartner[a] = b;
+        }
+        if (votes[k] > bestVotes[b]) {
+            bestVotes[b] = votes[k];
+            bestPartner[b] = a;
+        }
+    }
+
+    std::vector<std::vector<size_t>> members(count);
+    for (size_t i = 0; i < count; ++i) {
+        members[root(i)].push_back(i);
+    }
+    IntroClusters result;
+    for (auto &cluster : members) {
+        if (cluster.size() == 1) {
+            result.unclustered.push_back(cluster.front());
+        }
+        if (cluster.size() < 2) {
+            continue;
+        }
+        // the best connected file and its closest partner go first
+        size_t representative = cluster.front();
+        for (size_t i : cluster) {
+            if (edges[i] > edges[representative]) {
+                representative = i;
+            }
+        }
+        const size_t partner = bestPartner[representative];
+        std::vector<size_t> ordered = { representative, partner };
+        for (size_t i : cluster) {
+            if (i != representative && i != partner) {
+                ordered.push_back(i);
+            }
+        }
+        result.clusters.push_back(ordered);
+    }
+    std::sort(result.unclustered.begin(), result.unclustered.end());
+
+    return result;
+}
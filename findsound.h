@@ -4,11 +4,17 @@
 #define SOURCE_START 0
 #define SOURCE_END 600
 #define ACCEPTANCE_THRESHOLD 0.8
+// intros shorter than this, in seconds, are taken for chance matches
+#define MIN_INTRO_LENGTH 20
+// how many of the files most alike every file is compared with when clustering them
+#define CLUSTER_CANDIDATES 4
 
 #include <QString>
 #include <QObject>
 #include <QRunnable>
+#include <unordered_map>
 #include "signals.h"
+#include "fingerprint.h"
 
 struct CorrelateResult {
     size_t sampleIdx;
@@ -16,6 +22,12 @@ struct CorrelateResult {
     float timestamp;
 };
 
+// The best alignments of two signals in both directions, see FindSound::normalizedCrossCorrelation
+struct NccResult {
+    CorrelateResult twoInOne;
+    CorrelateResult oneInTwo;
+};
+
 struct IntroChunkSearchResult {
     float startTime;
     float endTime;
@@ -27,7 +39,7 @@ struct IntroInfo {
     float startTime;
     float endTime;
     float matchPercent;
-    FloatSignal *intro = nullptr;
+    SignalView intro;
     float otherStartTime = 0;
     float otherEndTime = 0;
 };
@@ -35,10 +47,22 @@ struct IntroInfo {
 struct FileSignal {
     FloatSignal* signal;
     QString file;
+    // built along with the signal, and owned by FindSound the same way
+    AudioFingerprint* fingerprint;
 };
 
 Q_DECLARE_METATYPE(FileSignal);
 
+// An intro found by a search, as a part of one of the files. FindSound keeps them, so that files
+// added later only have to be matched against them instead of being searched all over again.
+struct KnownIntro {
+    FileSignal source;
+    float startTime;
+    float endTime;
+};
+
+Q_DECLARE_METATYPE(KnownIntro);
+
 struct FindSoundResult {
     QString file;
     size_t index;
@@ -50,6 +74,18 @@ struct FindSoundResult {
 
 Q_DECLARE_METATYPE(FindSoundResult);
 
+// Files grouped by the intro they share, as indices into FindSound's files. The first file of a
+// cluster is its representative, and the second one is the file it shares the most with, so
+// that the search finds the intro of the cluster on its first try.
+struct IntroClusters {
+    std::vector<std::vector<size_t>> clusters;
+    // the files that didn't clearly share anything with another one
+    std::vector<size_t> unclustered;
+};
+
+Q_DECLARE_METATYPE(IntroClusters);
+Q_DECLARE_METATYPE(std::vector<size_t>);
+
 class LoadSoundDataTask : public QObject, public QRunnable
 {
     Q_OBJECT
@@ -65,9 +101,37 @@ class FindSoundTask : public QObject, public QRunnable
     Q_OBJECT
 public:
     std::vector<FileSignal> fileSignals;
+    // the index of every file signal among FindSound's files, which the results carry
+    std::vector<size_t> indices;
+    // intros found by earlier searches, which the files are matched against first
+    std::vector<KnownIntro> knownIntros;
+    // the best match of every file so far, by file, as the earlier searches left it
+    std::unordered_map<QString, float> bestMatches;
+    // whether to search the files that no known intro fits for new intros. If not, they are sent
+    // back with sendUnmatched instead of being reported as done.
+    bool discover = true;
     void run() override;
 signals:
     void sendFindResult(FindSoundResult findSoundResult);
+    void sendKnownIntro(KnownIntro knownIntro);
+    void sendUnmatched(std::vector<size_t> indices);
+private:
+    // Matches the intro against every file and reports the results, with the given number of
+    // threads. Returns the files it doesn't fit.
+    std::vector<FileSignal> matchIntroPass(const IntroInfo &introInfo, const FileSignal &source,
+                                           int threadCount);
+};
+
+class ClusterIntrosTask : public QObject, public QRunnable
+{
+    Q_OBJECT
+public:
+    std::vector<FileSignal> fileSignals;
+    // see FindSoundTask::indices, the clusters are sent with these
+    std::vector<size_t> indices;
+    void run() override;
+signals:
+    void sendIntroClusters(IntroClusters introClusters);
 };
 
 
@@ -75,25 +139,51 @@ class FindSound : public QObject
 {
     Q_OBJECT
 public:
+    enum SearchMode {
+        // walks the files in order, taking the intro of the first two neighbours that share one
+        // and matching it against every file, again and again until every file has an intro
+        AdjacentPairs,
+        // groups the files by the intro they share first, and then searches every group on its
+        // own and at the same time, so the work is bounded by groups times files
+        SeasonClusters
+    };
+
     FindSound();
     ~FindSound();
 
     void addFiles(std::vector<QString> filepaths);
-    int run();
+    // Searches the files whose intro hasn't been found yet, and returns how many there are. The
+    // intros found by earlier runs are tried on them first.
+    int run(SearchMode mode = SeasonClusters);
     static FloatSignal* getWavData(const char* path, double start, double duration);
-    static IntroInfo getIntroFromPair(FloatSignal* one, FloatSignal* two);
-    static FloatSignal* signalSlice(FloatSignal* signal, float start, float end);
-    static CorrelateResult howCloseAreSignals(FloatSignal* one, FloatSignal* two);
-    static CorrelateResult bestPatchPosition(FloatSignal* source, FloatSignal* patch);
+    static IntroInfo getIntroFromPair(const FileSignal &one, const FileSignal &two);
+    static SignalView signalSlice(const FloatSignal* signal, float start, float end);
+    static CorrelateResult howCloseAreSignals(const SignalView &one, const SignalView &two);
+    static NccResult normalizedCrossCorrelation(const SignalView &one, const SignalView &two);
+    static CorrelateResult bestPatchPosition(const SignalView &source, const SignalView &patch);
+    static CorrelateResult bestPatchPosition(const PreparedSignal* source, const SignalView &patch);
+    static std::vector<CorrelateResult> bestPatchPositions(const PreparedSignal* source,
+                                                           const std::vector<SignalView> &patches);
     static int nextBestIntro(const std::vector<FileSignal> &fileSignals, IntroInfo *result, int start);
+    static IntroClusters clusterByIntro(const std::vector<FileSignal> &fileSignals);
 private:
     std::vector<QString> filepaths;
     std::vector<FileSignal> fileSignals;
+    SearchMode searchMode = SeasonClusters;
+    std::vector<KnownIntro> knownIntros;
+    std::unordered_map<QString, float> bestMatches;
 
     static IntroChunkSearchResult doChunkScan(FloatSignal* one, FloatSignal* two, size_t patchStart, size_t patchEnd, int patchDuration);
+    static bool coarseToFinePatchPosition(const SignalView &source, const SignalView &patch,
+                                          CorrelateResult *result);
     static IntroChunkSearchResult getChunkSearchResults(std::vector<CorrelateResult>& sound_find_results, int patch_duration);
+    void startSearch(const std::vector<size_t> &indices, const std::vector<KnownIntro> &intros,
+                     bool discover);
 private slots:
     void receiveSoundData(FileSignal fileSignal);
+    void receiveIntroClusters(IntroClusters introClusters);
+    void receiveKnownIntro(KnownIntro knownIntro);
+    void discoverIntros(const std::vector<size_t> &indices);
     void receiveFindSoundResult(FindSoundResult findSoundResult);
 signals:
     void sendProgress();
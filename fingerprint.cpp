@@ -0,0 +1,300 @@
+#include "fingerprint.h"
+#include <algorithm>
+#include <cmath>
+
+// 0.25 s frames every 62.5 ms at 1024 Hz
+#define FINGERPRINT_FRAME_SIZE 256
+#define FINGERPRINT_HOP 64
+// bins 1 to 128 of the 129 of a frame, DC is left out
+#define FINGERPRINT_BINS 128
+// a peak is the largest value within this many frames and bins around it
+#define PEAK_TIME_RADIUS 4
+#define PEAK_FREQ_RADIUS 6
+// every peak is paired with up to this many of the next ones, within the target zone
+#define FAN_OUT 5
+#define TARGET_MAX_FRAMES 63
+#define TARGET_MAX_BINS 63
+// hashes that show up more often than this in a fingerprint come from steady tones or silence,
+// and match everything, so they are ignored
+#define MAX_HASH_OCCURRENCES 32
+// fewer landmarks than this agreeing on an offset is chance
+#define MIN_VOTES 12
+// landmarks further apart than this don't belong to the same common segment
+#define MAX_GAP_SECONDS 4
+
+static const float PI = 3.14159265358979f;
+
+static bool landmarkLess(const Landmark &a, const Landmark &b)
+{
+    return a.hash < b.hash || (a.hash == b.hash && a.frame < b.frame);
+}
+
+static bool landmarkHashLess(const Landmark &a, const Landmark &b)
+{
+    return a.hash < b.hash;
+}
+
+// Returns the offset whose votes, counting the ones right next to it, are the highest. The
+// peaks of two encodes of the same audio can be a frame apart, so the votes are spread a bit.
+static FingerprintMatch bestOffset(const std::vector<int> &votes, int firstOffset)
+{
+    FingerprintMatch best = { 0, 0 };
+    for (size_t i = 0; i < votes.size(); ++i) {
+        int sum = votes[i];
+        if (i > 0) {
+            sum += votes[i - 1];
+        }
+        if (i + 1 < votes.size()) {
+            sum += votes[i + 1];
+        }
+        if (sum > best.votes) {
+            best.offset = (int)i + firstOffset;
+            best.votes = sum;
+        }
+    }
+
+    return best;
+}
+
+AudioFingerprint::AudioFingerprint(const SignalView &signal, int sampleRate)
+    : sampleRate(sampleRate), frameCount(0)
+{
+    const std::vector<float> power = spectrogram(signal);
+    frameCount = (int)(power.size() / FINGERPRINT_BINS);
+    if (frameCount == 0) {
+        return;
+    }
+
+    // the peaks that stand out of the average are kept, which leaves out silence
+    double sum = 0;
+    for (float value : power) {
+        sum += value;
+    }
+    const float threshold = (float)(sum / power.size());
+
+    // largest value around every point, over the bins first and then over the frames
+    std::vector<float> freqMax(power.size());
+    for (int t = 0; t < frameCount; ++t) {
+        const float *row = &power[(size_t)t * FINGERPRINT_BINS];
+        for (int b = 0; b < FINGERPRINT_BINS; ++b) {
+            const int first = std::max(b - PEAK_FREQ_RADIUS, 0);
+            const int last = std::min(b + PEAK_FREQ_RADIUS, FINGERPRINT_BINS - 1);
+            freqMax[(size_t)t * FINGERPRINT_BINS + b] = *std::max_element(row + first, row + last + 1);
+        }
+    }
+    std::vector<std::pair<int, int>> peaks;
+    for (int t = 0; t < frameCount; ++t) {
+        const int first = std::max(t - PEAK_TIME_RADIUS, 0);
+        const int last = std::min(t + PEAK_TIME_RADIUS, frameCount - 1);
+        for (int b = 0; b < FINGERPRINT_BINS; ++b) {
+            const float value = power[(size_t)t * FINGERPRINT_BINS + b];
+            if (value <= threshold) {
+                continue;
+            }
+            bool isPeak = true;
+            for (int u = first; u <= last && isPeak; ++u) {
+                isPeak = freqMax[(size_t)u * FINGERPRINT_BINS + b] <= value;
+            }
+            if (isPeak) {
+                peaks.push_back(std::make_pair(t, b));
+            }
+        }
+    }
+
+    for (size_t i = 0; i < peaks.size(); ++i) {
+        const int t = peaks[i].first;
+        const int b = peaks[i].second;
+        int paired = 0;
+        for (size_t j = i + 1; j < peaks.size() && paired < FAN_OUT; ++j) {
+            const int dt = peaks[j].first - t;
+            if (dt > TARGET_MAX_FRAMES) {
+                break;
+            }
+            const int df = peaks[j].second - b;
+            if (dt == 0 || std::abs(df) > TARGET_MAX_BINS) {
+                continue;
+            }
+            // 7 bits of frequency, 7 of frequency difference and 6 of time difference
+            const uint32_t hash = ((uint32_t)b << 13) | ((uint32_t)(df + 64) << 6) | (uint32_t)dt;
+            const Landmark landmark = { hash, t };
+            landmarks.push_back(landmark);
+            paired++;
+        }
+    }
+    std::sort(landmarks.begin(), landmarks.end(), landmarkLess);
+}
+
+std::vector<float> AudioFingerprint::spectrogram(const SignalView &signal) const
+{
+    std::vector<float> power;
+    if (signal.getSize() < FINGERPRINT_FRAME_SIZE) {
+        return power;
+    }
+    const size_t frames = (signal.getSize() - FINGERPRINT_FRAME_SIZE) / FINGERPRINT_HOP + 1;
+    power.resize(frames * FINGERPRINT_BINS);
+
+    std::vector<float> window(FINGERPRINT_FRAME_SIZE);
+    for (size_t i = 0; i < window.size(); ++i) {
+        window[i] = 0.5f - 0.5f * std::cos(2.0f * PI * i / (FINGERPRINT_FRAME_SIZE - 1));
+    }
+
+    FloatSignal frame(FINGERPRINT_FRAME_SIZE);
+    ComplexSignal spectrum(FINGERPRINT_FRAME_SIZE / 2 + 1);
+    FftForwardPlan plan(frame, spectrum);
+    float *frameData = frame.getData();
+    const fftwf_complex *spectrumData = spectrum.getData();
+    for (size_t t = 0; t < frames; ++t) {
+        signal.copyZeroPadded((long long)(t * FINGERPRINT_HOP), frameData, FINGERPRINT_FRAME_SIZE);
+        for (size_t i = 0; i < window.size(); ++i) {
+            frameData[i] *= window[i];
+        }
+        plan.execute();
+        float *row = &power[t * FINGERPRINT_BINS];
+        for (int b = 0; b < FINGERPRINT_BINS; ++b) {
+            const float re = spectrumData[b + 1][0];
+            const float im = spectrumData[b + 1][1];
+            row[b] = std::log(re * re + im * im + 1e-10f);
+        }
+    }
+
+    return power;
+}
+
+std::vector<Landmark> AudioFingerprint::landmarksBetween(float start, float end) const
+{
+    const int startFrame = secondsToFrame(start);
+    const int endFrame = secondsToFrame(end);
+    std::vector<Landmark> result;
+    for (const Landmark &landmark : landmarks) {
+        if (landmark.frame >= startFrame && landmark.frame < endFrame) {
+            const Landmark relative = { landmark.hash, landmark.frame - startFrame };
+            result.push_back(relative);
+        }
+    }
+
+    return result;
+}
+
+bool AudioFingerprint::bestMatch(const std::vector<Landmark> &query, FingerprintMatch *match) const
+{
+    if (frameCount == 0) {
+        return false;
+    }
+
+    // only the offsets where the query starts inside of this are counted
+    std::vector<int> votes((size_t)frameCount, 0);
+    for (const Landmark &landmark : query) {
+        auto range = std::equal_range(landmarks.begin(), landmarks.end(), landmark, landmarkHashLess);
+        if (range.second - range.first > MAX_HASH_OCCURRENCES) {
+            continue;
+        }
+        for (auto it = range.first; it != range.second; ++it) {
+            const int offset = it->frame - landmark.frame;
+            if (offset >= 0) {
+                votes[(size_t)offset]++;
+            }
+        }
+    }
+
+    *match = bestOffset(votes, 0);
+
+    return match->votes >= MIN_VOTES;
+}
+
+bool AudioFingerprint::commonSegment(const AudioFingerprint &other, FingerprintSegment *segment) const
+{
+    if (frameCount == 0 || other.frameCount == 0) {
+        return false;
+    }
+
+    // offsets go from the end of this lining up with the start of the other to the other way
+    // around; both landmark lists are sorted by hash, so the matching ones are found by merging
+    const int firstOffset = -(frameCount - 1);
+    std::vector<int> votes((size_t)(frameCount + other.frameCount - 1), 0);
+    std::vector<std::pair<int, int>> pairs;
+    auto a = landmarks.begin();
+    auto b = other.landmarks.begin();
+    while (a != landmarks.end() && b != other.landmarks.end()) {
+        if (a->hash < b->hash) {
+            ++a;
+            continue;
+        }
+        if (b->hash < a->hash) {
+            ++b;
+            continue;
+        }
+        auto aEnd = std::upper_bound(a, landmarks.end(), *a, landmarkHashLess);
+        auto bEnd = std::upper_bound(b, other.landmarks.end(), *b, landmarkHashLess);
+        if (aEnd - a <= MAX_HASH_OCCURRENCES && bEnd - b <= MAX_HASH_OCCURRENCES) {
+            for (auto i = a; i != aEnd; ++i) {
+                for (auto j = b; j != bEnd; ++j) {
+                    votes[(size_t)(j->frame - i->frame - firstOffset)]++;
+                    pairs.push_back(std::make_pair(i->frame, j->frame - i->frame));
+                }
+            }
+        }
+        a = aEnd;
+        b = bEnd;
+    }
+
+    const FingerprintMatch best = bestOffset(votes, firstOffset);
+    if (best.votes < MIN_VOTES) {
+        return false;
+    }
+
+    // the frames of this that agree with the offset, split where they are too far apart
+    std::vector<int> frames;
+    for (auto &pair : pairs) {
+        if (std::abs(pair.second - best.offset) <= 1) {
+            frames.push_back(pair.first);
+        }
+    }
+    std::sort(frames.begin(), frames.end());
+    const int maxGap = secondsToFrame(MAX_GAP_SECONDS);
+    size_t bestStart = 0;
+    size_t bestEnd = 0;
+    for (size_t start = 0, i = 1; i <= frames.size(); ++i) {
+        if (i == frames.size() || frames[i] - frames[i - 1] > maxGap) {
+            if (frames[i - 1] - frames[start] > frames[bestEnd] - frames[bestStart]) {
+                bestStart = start;
+                bestEnd = i - 1;
+            }
+            start = i;
+        }
+    }
+    const int votesInSegment = (int)(bestEnd - bestStart + 1);
+    if (votesInSegment < MIN_VOTES) {
+        return false;
+    }
+
+    segment->startTime = frameToSeconds(frames[bestStart]);
+    segment->endTime = frameToSeconds(frames[bestEnd]) + (float)FINGERPRINT_FRAME_SIZE / sampleRate;
+    segment->otherStartTime = frameToSeconds(std::max(frames[bestStart] + best.offset, 0));
+    segment->votes = votesInSegment;
+
+    return true;
+}
+
+std::vector<uint32_t> AudioFingerprint::distinctHashes() const
+{
+    std::vector<uint32_t> result;
+    for (auto it = landmarks.begin(); it != landmarks.end();) {
+        auto end = std::upper_bound(it, landmarks.end(), *it, landmarkHashLess);
+        if (end - it <= MAX_HASH_OCCURRENCES) {
+            result.push_back(it->hash);
+        }
+        it = end;
+    }
+
+    return result;
+}
+
+float AudioFingerprint::frameToSeconds(int frame) const
+{
+    return (float)frame * FINGERPRINT_HOP / sampleRate;
+}
+
+int AudioFingerprint::secondsToFrame(float seconds) const
+{
+    return (int)(seconds * sampleRate / FINGERPRINT_HOP);
+}
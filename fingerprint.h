@@ -0,0 +1,68 @@
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <cstdint>
+#include <vector>
+#include "signals.h"
+
+// A pair of spectral peaks: the hash packs the frequency of the first one, the frequency
+// difference and the time difference to the second one, and frame is when the first one is.
+struct Landmark {
+    uint32_t hash;
+    int32_t frame;
+};
+
+// Where a query fits in a fingerprint: the frame of the fingerprint the query's frame 0 lines up
+// with, and how many landmarks agree with that.
+struct FingerprintMatch {
+    int offset;
+    int votes;
+};
+
+// The longest stretch two fingerprints have in common, in seconds of each of them.
+struct FingerprintSegment {
+    float startTime;
+    float endTime;
+    float otherStartTime;
+    int votes;
+};
+
+// Landmark fingerprint of a signal, in the style of Shazam: the peaks of its spectrogram are
+// paired up, and every pair is hashed with the time between them. Two signals that share a part
+// share the landmarks of that part at a constant time offset, so that part can be found with hash
+// lookups and a histogram of the offsets, instead of cross-correlating the whole signals. Matches
+// are only as precise as the hop between spectrogram frames (62.5 ms at 1024 Hz), and are meant
+// to be verified with a cross-correlation.
+class AudioFingerprint
+{
+public:
+    AudioFingerprint(const SignalView &signal, int sampleRate);
+
+    // The landmarks that start between the given times, with frames relative to the start.
+    std::vector<Landmark> landmarksBetween(float start, float end) const;
+    // Finds where landmarks taken from another signal (see landmarksBetween) fit best in this one.
+    // Returns false if too few of them agree on any position.
+    bool bestMatch(const std::vector<Landmark> &query, FingerprintMatch *match) const;
+    // Finds the longest stretch this has in common with the other fingerprint. Returns false if
+    // too few landmarks agree on any offset between the two.
+    bool commonSegment(const AudioFingerprint &other, FingerprintSegment *segment) const;
+
+    // Every hash of the fingerprint once, in order, leaving out the ones that are too common to
+    // tell anything. Files that share a part share many of these, whatever the offset.
+    std::vector<uint32_t> distinctHashes() const;
+
+    float frameToSeconds(int frame) const;
+    int secondsToFrame(float seconds) const;
+    size_t getLandmarkCount() const { return landmarks.size(); }
+
+private:
+    int sampleRate;
+    int frameCount;
+    // sorted by hash, then frame
+    std::vector<Landmark> landmarks;
+
+    // log power of bins 1 to FINGERPRINT_BINS of every frame, frame after frame
+    std::vector<float> spectrogram(const SignalView &signal) const;
+};
+
+#endif // FINGERPRINT_H
@@ -17,6 +17,9 @@ int main(int argc, char *argv[])
     qRegisterMetaType<Image>();
     qRegisterMetaType<FileSignal>();
     qRegisterMetaType<FindSoundResult>();
+    qRegisterMetaType<IntroClusters>();
+    qRegisterMetaType<KnownIntro>();
+    qRegisterMetaType<std::vector<size_t>>();
 
     MainWindow w;
     w.show();
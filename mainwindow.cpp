@@ -64,8 +64,12 @@ void MainWindow::addVideosButton() {
 
 void MainWindow::findIntrosButton()
 {
-    setButtonsEnabled(false);
     const int count = findSound->run();
+    if (count == 0) {
+        ui->statusbar->showMessage("Every intro has been found already.");
+        return;
+    }
+    setButtonsEnabled(false);
     progressContext = { count, 0 };
     beginProgress();
     ui->statusbar->showMessage("Finding intros in videos...");
@@ -97,9 +101,11 @@ void MainWindow::maybeRenderVideoThumbnail() {
         const bool isInside = (itemTop > scrollTop || itemBottom < scrollBottom) && !isOutside;
         if (isInside) {
             item->isVisible = true;
-            item->renderThumbnails();
+            // while scrolling, the closest keyframes are shown, which is much faster
+            item->renderThumbnails(false);
         } else {
             item->isVisible = false;
+            item->cancelThumbnails();
         }
     }
 }
@@ -9,23 +9,37 @@ CONFIG += c++11
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    audiocache.cpp \
+    cachedirectory.cpp \
     execution_timer.cpp \
     ffmpeg.cpp \
+    fingerprint.cpp \
     findsound.cpp \
     main.cpp \
     mainwindow.cpp \
     misc_util.cpp \
+    readahead.cpp \
     signals.cpp \
+    signals_simd.cpp \
+    taskscheduler.cpp \
+    thumbnailcache.cpp \
     videolistitem.cpp
 
 HEADERS += \
+    audiocache.h \
+    cachedirectory.h \
     cute_files.h \
     execution_timer.h \
     ffmpeg.h \
+    fingerprint.h \
     findsound.h \
     mainwindow.h \
     misc_util.h \
+    readahead.h \
     signals.h \
+    signals_simd.h \
+    taskscheduler.h \
+    thumbnailcache.h \
     videolistitem.h
 
 FORMS += \
@@ -0,0 +1,253 @@
+#include "readahead.h"
+#include <algorithm>
+#include <cstring>
+
+// fseek and ftell are limited to 2 GB on Windows
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+#else
+#define fseek64 fseeko
+#define ftell64 ftello
+#endif
+
+ReadAheadFile* ReadAheadFile::open(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return nullptr;
+    }
+    if (fseek64(file, 0, SEEK_END) != 0) {
+        fclose(file);
+        return nullptr;
+    }
+    const int64_t size = ftell64(file);
+    if (size < 0) {
+        fclose(file);
+        return nullptr;
+    }
+
+    return new ReadAheadFile(file, size);
+}
+
+ReadAheadFile::ReadAheadFile(FILE* file, int64_t size)
+    : file(file), fileSize(size), position(0), windowStart(0), wholeBlock(-1),
+      stopping(false)
+{
+    thread = std::thread(&ReadAheadFile::prefetch, this);
+}
+
+ReadAheadFile::~ReadAheadFile()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    thread.join();
+    fclose(file);
+}
+
+std::vector<int64_t> ReadAheadFile::window() const
+{
+    const int64_t blockCount = (fileSize + (int64_t)BLOCK_SIZE - 1) / (int64_t)BLOCK_SIZE;
+    std::vector<int64_t> result;
+    // the block being read is always needed
+    if (windowStart >= blockCount) {
+        return result;
+    }
+    result.push_back(windowStart);
+    if (ranges.empty()) {
+        for (int64_t i = windowStart + 1; i < blockCount && result.size() < BLOCKS_AHEAD; ++i) {
+            result.push_back(i);
+        }
+        return result;
+    }
+
+    // the next blocks that hold any wanted range, skipping the ones in between
+    const int64_t from = (windowStart + 1) * (int64_t)BLOCK_SIZE;
+    auto range = std::lower_bound(ranges.begin(), ranges.end(), from,
+                                  [](const std::pair<int64_t, int64_t> &r, int64_t offset) {
+        return r.second <= offset;
+    });
+    for (; range != ranges.end() && result.size() < BLOCKS_AHEAD; ++range) {
+        const int64_t first = std::max(range->first, from) / (int64_t)BLOCK_SIZE;
+        const int64_t last = std::min((range->second - 1) / (int64_t)BLOCK_SIZE, blockCount - 1);
+        for (int64_t i = std::max(first, result.back() + 1); i <= last && result.size() < BLOCKS_AHEAD; ++i) {
+            result.push_back(i);
+        }
+    }
+
+    return result;
+}
+
+std::pair<int64_t, int64_t> ReadAheadFile::wantedPart(int64_t index) const
+{
+    const int64_t blockBegin = index * (int64_t)BLOCK_SIZE;
+    const int64_t blockEnd = std::min(blockBegin + (int64_t)BLOCK_SIZE, fileSize);
+    if (ranges.empty() || index == wholeBlock) {
+        return std::make_pair(blockBegin, blockEnd);
+    }
+
+    // from the first to the last wanted byte of the block
+    auto range = std::lower_bound(ranges.begin(), ranges.end(), blockBegin,
+                                  [](const std::pair<int64_t, int64_t> &r, int64_t offset) {
+        return r.second <= offset;
+    });
+    if (range == ranges.end() || range->first >= blockEnd) {
+        // the block being read doesn't hold anything wanted, so read it whole
+        return std::make_pair(blockBegin, blockEnd);
+    }
+    const int64_t begin = std::max(range->first, blockBegin);
+    int64_t end = begin;
+    for (; range != ranges.end() && range->first < blockEnd; ++range) {
+        end = std::min(range->second, blockEnd);
+    }
+
+    return std::make_pair(begin, end);
+}
+
+void ReadAheadFile::prefetch()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        // drop whatever fell out of the window, and fetch the first block of it that's missing
+        const std::vector<int64_t> wanted = window();
+        for (auto it = blocks.begin(); it != blocks.end();) {
+            const bool inWindow = std::find(wanted.begin(), wanted.end(), it->first) != wanted.end();
+            it = inWindow ? std::next(it) : blocks.erase(it);
+        }
+        for (auto it = failedBlocks.begin(); it != failedBlocks.end();) {
+            const bool inWindow = std::find(wanted.begin(), wanted.end(), *it) != wanted.end();
+            it = inWindow ? std::next(it) : failedBlocks.erase(it);
+        }
+        int64_t next = -1;
+        for (int64_t i : wanted) {
+            if (blocks.find(i) == blocks.end() && failedBlocks.count(i) == 0) {
+                next = i;
+                break;
+            }
+        }
+        if (next < 0) {
+            changed.wait(lock);
+            continue;
+        }
+        const std::pair<int64_t, int64_t> part = wantedPart(next);
+
+        // the file is only ever touched from this thread, so it can be read without the lock
+        lock.unlock();
+        Block block;
+        block.begin = part.first;
+        block.data.resize((size_t)(part.second - part.first));
+        const bool ok = fseek64(file, block.begin, SEEK_SET) == 0
+                && fread(block.data.data(), 1, block.data.size(), file) == block.data.size();
+        lock.lock();
+
+        if (ok) {
+            blocks[next] = std::move(block);
+        } else {
+            failedBlocks.insert(next);
+        }
+        changed.notify_all();
+    }
+}
+
+int ReadAheadFile::read(uint8_t* buffer, int size)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (position >= fileSize) {
+        return 0;
+    }
+
+    const int64_t index = position / (int64_t)BLOCK_SIZE;
+    if (windowStart != index) {
+        windowStart = index;
+        changed.notify_all();
+    }
+    // whatever failed before, whether it was fetched ahead or read already, is tried again
+    if (failedBlocks.erase(index) > 0) {
+        changed.notify_all();
+    }
+    auto found = blocks.end();
+    while (true) {
+        found = blocks.find(index);
+        if (found == blocks.end()) {
+            if (failedBlocks.count(index) > 0) {
+                return -1;
+            }
+            changed.wait(lock);
+            continue;
+        }
+        const Block &block = found->second;
+        if (position >= block.begin && position < block.begin + (int64_t)block.data.size()) {
+            break;
+        }
+        // read outside of the wanted part, fetch the whole block instead
+        wholeBlock = index;
+        blocks.erase(found);
+        found = blocks.end();
+        changed.notify_all();
+    }
+
+    const Block &block = found->second;
+    const size_t offset = (size_t)(position - block.begin);
+    const size_t count = std::min((size_t)size, block.data.size() - offset);
+    memcpy(buffer, block.data.data() + offset, count);
+    position += count;
+
+    return (int)count;
+}
+
+int64_t ReadAheadFile::seek(int64_t offset, int whence)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    int64_t target;
+    switch (whence) {
+    case SEEK_SET:
+        target = offset;
+        break;
+    case SEEK_CUR:
+        target = position + offset;
+        break;
+    case SEEK_END:
+        target = fileSize + offset;
+        break;
+    default:
+        return -1;
+    }
+    if (target < 0 || target > fileSize) {
+        return -1;
+    }
+    // the window follows on the next read
+    position = target;
+    // and the blocks that failed may be fine now
+    if (!failedBlocks.empty()) {
+        failedBlocks.clear();
+        changed.notify_all();
+    }
+
+    return position;
+}
+
+void ReadAheadFile::setWantedRanges(const std::vector<std::pair<int64_t, int64_t>> &wanted)
+{
+    std::vector<std::pair<int64_t, int64_t>> merged;
+    for (auto &range : wanted) {
+        if (range.second <= range.first) {
+            continue;
+        }
+        if (!merged.empty() && range.first - merged.back().second < MERGE_GAP) {
+            merged.back().second = std::max(merged.back().second, range.second);
+        } else {
+            merged.push_back(range);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ranges = std::move(merged);
+    wholeBlock = -1;
+    failedBlocks.clear();
+    // blocks fetched for the old ranges may be missing parts, so start over
+    blocks.clear();
+    changed.notify_all();
+}
@@ -0,0 +1,80 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A read-only file that is read in large blocks by a background thread, a few blocks ahead of
+// wherever it is being read from. Demuxers read in small pieces, and on a network share every one
+// of them would be a round trip: with the read-ahead, reads are served from memory while the next
+// blocks are already on their way, so reading is limited by bandwidth rather than by latency.
+// Only a bounded window after the read position is fetched, so a file that is only partly read
+// (like the first minutes of a video) is only partly fetched too. Seeking just moves the window.
+// If the reader knows which parts of the file it is going to need (see setWantedRanges), only those
+// are read ahead, and the rest is only fetched if it is actually read.
+// Used as the I/O of the media sessions, see acquire_media_session.
+class ReadAheadFile
+{
+public:
+    static const size_t BLOCK_SIZE = 1 << 20;
+    static const size_t BLOCKS_AHEAD = 8;
+
+    // Returns nullptr if the file can't be opened.
+    static ReadAheadFile* open(const char* path);
+    ~ReadAheadFile();
+
+    // Reads up to size bytes at the current position, and returns how many were read, 0 at the
+    // end of the file or -1 on errors. Waits for the data if it hasn't been fetched yet. Errors
+    // only concern the block that couldn't be fetched, which is tried again on the next read.
+    int read(uint8_t* buffer, int size);
+    // Same as fseek, but returns the new position, or -1 if it's out of the file.
+    int64_t seek(int64_t offset, int whence);
+    int64_t size() const { return fileSize; }
+    // Restricts the read-ahead to the given [begin, end) byte ranges, which must be sorted and not
+    // overlap. Ranges closer than MERGE_GAP are fetched together. An empty list reads everything.
+    void setWantedRanges(const std::vector<std::pair<int64_t, int64_t>> &ranges);
+
+    static const int64_t MERGE_GAP = 64 * 1024;
+
+private:
+    // the fetched part of a block, which is all of it unless there are wanted ranges
+    struct Block {
+        int64_t begin;
+        std::vector<uint8_t> data;
+    };
+
+    ReadAheadFile(FILE* file, int64_t size);
+    void prefetch();
+    // the blocks that should be fetched, in order, and the part of each one that's needed
+    std::vector<int64_t> window() const;
+    std::pair<int64_t, int64_t> wantedPart(int64_t index) const;
+
+    FILE* file;
+    int64_t fileSize;
+    int64_t position;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    // fetched blocks by index, only the ones in the window are kept
+    std::map<int64_t, Block> blocks;
+    // first block of the window, the one at the read position
+    int64_t windowStart;
+    // merged wanted ranges, empty if everything is wanted
+    std::vector<std::pair<int64_t, int64_t>> ranges;
+    // a block that was read outside of its wanted part, so it has to be fetched whole
+    int64_t wholeBlock;
+    // blocks whose last fetch failed, which aren't fetched again until they are read again, so that
+    // a bad spot of the file fails the reads of it rather than every read after it
+    std::set<int64_t> failedBlocks;
+    bool stopping;
+    std::thread thread;
+};
+
+#endif // READAHEAD_H
@@ -1,7 +1,24 @@
 #include "signals.h"
+#include "signals_simd.h"
+#include <algorithm>
 
 size_t Pow2Ceil(size_t x) { return (size_t)pow(2, ceil(log2(x))); }
 
+std::mutex& FftwPlannerMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+fftwf_plan PlanDftR2c1d(int n, float* in, fftwf_complex* out, unsigned flags) {
+    std::lock_guard<std::mutex> lock(FftwPlannerMutex());
+    return fftwf_plan_dft_r2c_1d(n, in, out, flags);
+}
+
+fftwf_plan PlanDftC2r1d(int n, fftwf_complex* in, float* out, unsigned flags) {
+    std::lock_guard<std::mutex> lock(FftwPlannerMutex());
+    return fftwf_plan_dft_c2r_1d(n, in, out, flags);
+}
+
 void CheckRealComplexRatio(const size_t real_size, const size_t complex_size,
    const std::string func_name) {
     if (complex_size != (real_size / 2 + 1)) {
@@ -15,31 +32,279 @@ void check_a_less_equal_b(const size_t a, const size_t b,
     CheckTwoElements(a, b, [](const size_t a, const size_t b) {return a > b; }, message);
 }
 
+void SignalMeanStd(const float* data, const size_t size, float* mean, float* std) {
+    static const MomentsKernel kMoments = GetMomentsKernel(GetSimdLevel());
+    if (size == 0) {
+        *mean = 0;
+        *std = 0;
+        return;
+    }
+    const float kShift = data[0];
+    double sum = 0;
+    double sum_squares = 0;
+    kMoments(data, size, kShift, &sum, &sum_squares);
+    const double kShiftedMean = sum / size;
+    const double kVariance = std::max(sum_squares / size - kShiftedMean * kShiftedMean, 0.0);
+    *mean = (float)(kShiftedMean + kShift);
+    *std = (float)sqrt(kVariance);
+}
+
+void FloatSignal::meanStd(float* mean, float* std) const {
+    SignalMeanStd(data_, size_, mean, std);
+}
+
+void NormalizeSignal(const float* src, const size_t size, float* dst, const float divisor) {
+    NormalizeSignal(SignalView(src, size), dst, divisor);
+}
+
+void SignalView::copyZeroPadded(const long long offset, float* dst, const size_t dst_size) const {
+    CopyZeroPadded(data_, data_size_, offset, dst, dst_size);
+}
+
+void SignalView::meanStd(float* mean, float* std) const {
+    SignalMeanStd(data_, data_size_, mean, std);
+    if (size_ == data_size_ || size_ == 0) { return; }
+    // the zeros add nothing to the sums, they only scale the moments down
+    const double kFraction = (double)data_size_ / size_;
+    const double kMean = *mean * kFraction;
+    const double kMeanSquares = ((double)*std * *std + (double)*mean * *mean) * kFraction;
+    *mean = (float)kMean;
+    *std = (float)sqrt(std::max(kMeanSquares - kMean * kMean, 0.0));
+}
+
+void NormalizeSignal(const SignalView& src, float* dst, const float divisor) {
+    float mean, std;
+    src.meanStd(&mean, &std);
+    const float kScale = std > 0 ? 1.0f / (std * divisor) : 0.0f;
+    const float* data = src.getData();
+    const size_t kDataSize = src.getDataSize();
+    for (size_t i = 0; i < kDataSize; ++i) {
+        dst[i] = (data[i] - mean) * kScale;
+    }
+    const float kPadding = -mean * kScale;
+    for (size_t i = kDataSize; i < src.getSize(); ++i) {
+        dst[i] = kPadding;
+    }
+}
+
+FloatSignal* DecimatedEnvelope(const SignalView& src, const size_t factor) {
+    const size_t kSize = (src.getSize() + factor - 1) / factor;
+    FloatSignal* result = new FloatSignal(kSize);
+    float* dst = result->getData();
+    const float* data = src.getData();
+    const size_t kDataSize = src.getDataSize();
+    double sum = 0;
+    for (size_t i = 0; i < kSize; ++i) {
+        const size_t kBegin = i * factor;
+        const size_t kEnd = std::min(kBegin + factor, src.getSize());
+        // the padding zeros only count towards the length of the block
+        float block_sum = 0;
+        for (size_t j = kBegin; j < std::min(kEnd, kDataSize); ++j) {
+            block_sum += std::fabs(data[j]);
+        }
+        dst[i] = block_sum / (kEnd - kBegin);
+        sum += dst[i];
+    }
+    const float kMean = kSize > 0 ? (float)(sum / kSize) : 0.0f;
+    for (size_t i = 0; i < kSize; ++i) {
+        dst[i] -= kMean;
+    }
+    return result;
+}
+
+// Throws if the three spectra don't have the same size. The message is only built on failure,
+// since this runs for every chunk of every correlation.
+static void CheckSpectraSizes(const ComplexSignal& a, const ComplexSignal& b,
+    const ComplexSignal& result, const char* func_name) {
+    if (a.getSize() != b.getSize() || a.getSize() != result.getSize()) {
+        throw std::runtime_error(std::string("[ERROR] ") + func_name +
+            ": all sizes must be equal and are");
+    }
+}
+
+// the fastest kernels that this CPU supports, picked the first time they are needed
+static const SpectralKernels& DispatchedSpectralKernels() {
+    static const SpectralKernels kKernels = GetSpectralKernels(GetSimdLevel());
+    return kKernels;
+}
+
 void SpectralConvolution(const ComplexSignal& a, const ComplexSignal& b, ComplexSignal& result) {
-    const size_t kSize_a = a.getSize();
-    const size_t kSize_b = b.getSize();
-    const size_t kSize_result = result.getSize();
-    CheckAllEqual({ kSize_a, kSize_b, kSize_result },
-        "SpectralConvolution: all sizes must be equal and are");
-    for (size_t i = 0; i < kSize_a; ++i) {
+    CheckSpectraSizes(a, b, result, "SpectralConvolution");
+    SpectralConvolution(a.getData(), b.getData(), result.getData(), a.getSize());
+}
+
+void SpectralConvolution(const fftwf_complex* a, const fftwf_complex* b, fftwf_complex* result,
+    const size_t size) {
+    DispatchedSpectralKernels().convolution(a, b, result, size);
+}
+
+void SpectralConvolutionScalar(const fftwf_complex* a, const fftwf_complex* b,
+    fftwf_complex* result, const size_t size) {
+    for (size_t i = 0; i < size; ++i) {
         // a+ib * c+id = ac+iad+ibc-bd = ac-bd + i(ad+bc)
-        result[i][REAL] = a[i][REAL] * b[i][REAL] - a[i][IMAG] * b[i][IMAG];
-        result[i][IMAG] = a[i][IMAG] * b[i][REAL] + a[i][REAL] * b[i][IMAG];
+        const float kReal = a[i][REAL] * b[i][REAL] - a[i][IMAG] * b[i][IMAG];
+        const float kImag = a[i][IMAG] * b[i][REAL] + a[i][REAL] * b[i][IMAG];
+        result[i][REAL] = kReal;
+        result[i][IMAG] = kImag;
     }
 }
 
 void SpectralCorrelation(const ComplexSignal& a, const ComplexSignal& b, ComplexSignal& result) {
-    const size_t kSize_a = a.getSize();
-    const size_t kSize_b = b.getSize();
-    const size_t kSize_result = result.getSize();
-    CheckAllEqual({ kSize_a, kSize_b, kSize_result },
-        "SpectralCorrelation: all sizes must be equal and are");
-    for (size_t i = 0; i < kSize_a; ++i) {
+    CheckSpectraSizes(a, b, result, "SpectralCorrelation");
+    SpectralCorrelation(a.getData(), b.getData(), result.getData(), a.getSize());
+}
+
+void SpectralCorrelation(const fftwf_complex* a, const fftwf_complex* b, fftwf_complex* result,
+    const size_t size) {
+    DispatchedSpectralKernels().correlation(a, b, result, size);
+}
+
+void SpectralCorrelationScalar(const fftwf_complex* a, const fftwf_complex* b,
+    fftwf_complex* result, const size_t size) {
+    for (size_t i = 0; i < size; ++i) {
         // a * conj(b) = a+ib * c-id = ac-iad+ibc+bd = ac+bd + i(bc-ad)
-        result[i][REAL] = a[i][REAL] * b[i][REAL] + a[i][IMAG] * b[i][IMAG];
-        result[i][IMAG] = a[i][IMAG] * b[i][REAL] - a[i][REAL] * b[i][IMAG];
+        const float kReal = a[i][REAL] * b[i][REAL] + a[i][IMAG] * b[i][IMAG];
+        const float kImag = a[i][IMAG] * b[i][REAL] - a[i][REAL] * b[i][IMAG];
+        result[i][REAL] = kReal;
+        result[i][IMAG] = kImag;
+    }
+}
+
+FftBatchForwardPlan::FftBatchForwardPlan(FloatSignal& fs, ComplexSignal& cs, const size_t n,
+    const size_t howmany)
+    : FftPlan(nullptr) {
+    CheckAllEqual({ fs.getSize(), n * howmany }, "FftBatchForwardPlan: size(FloatSignal) must be n*howmany");
+    CheckAllEqual({ cs.getSize(), (n / 2 + 1) * howmany },
+        "FftBatchForwardPlan: size(ComplexSignal) must be (n/2+1)*howmany");
+    const int kN = (int)n;
+    std::lock_guard<std::mutex> lock(FftwPlannerMutex());
+    plan_ = fftwf_plan_many_dft_r2c(1, &kN, (int)howmany,
+        fs.getData(), nullptr, 1, kN,
+        cs.getData(), nullptr, 1, kN / 2 + 1,
+        FFTW_ESTIMATE);
+}
+
+void CopyZeroPadded(const float* src, const size_t src_size, const long long offset,
+    float* dst, const size_t dst_size) {
+    const long long kEnd = offset + (long long)dst_size;
+    // the part of [offset, kEnd) that actually overlaps the source
+    const long long kCopyBegin = std::max(offset, 0LL);
+    const long long kCopyEnd = std::min(kEnd, (long long)src_size);
+    if (kCopyBegin >= kCopyEnd) {
+        memset(dst, 0, sizeof(float) * dst_size);
+        return;
+    }
+    const size_t kLeadingZeros = (size_t)(kCopyBegin - offset);
+    const size_t kCopySize = (size_t)(kCopyEnd - kCopyBegin);
+    memset(dst, 0, sizeof(float) * kLeadingZeros);
+    memcpy(dst + kLeadingZeros, src + kCopyBegin, sizeof(float) * kCopySize);
+    memset(dst + kLeadingZeros + kCopySize, 0,
+        sizeof(float) * (dst_size - kLeadingZeros - kCopySize));
+}
+
+ConvolverWorkspace::ConvolverWorkspace(const size_t chunksize)
+    : chunksize_(chunksize),
+    chunksize_complex_(chunksize / 2 + 1),
+    in_use_(false),
+    patch_(chunksize_),
+    patch_complex_(chunksize_complex_),
+    forward_plan_(patch_, patch_complex_),
+    backward_plan_(patch_complex_, patch_) {}
 
+ConvolverWorkspace* ConvolverWorkspace::Acquire(const size_t chunksize) {
+    // most recently used at the back
+    thread_local std::vector<std::unique_ptr<ConvolverWorkspace>> cache;
+    ConvolverWorkspace* workspace = nullptr;
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+        if ((*it)->chunksize_ == chunksize && !(*it)->in_use_) {
+            std::unique_ptr<ConvolverWorkspace> found = std::move(*it);
+            cache.erase(it);
+            cache.push_back(std::move(found));
+            workspace = cache.back().get();
+            break;
+        }
     }
+    if (workspace == nullptr) {
+        // evict the least recently used idle workspace if the cache is full
+        size_t idle = 0;
+        for (auto& cached : cache) { idle += cached->in_use_ ? 0 : 1; }
+        if (idle >= kMaxCachedPerThread) {
+            for (auto it = cache.begin(); it != cache.end(); ++it) {
+                if (!(*it)->in_use_) {
+                    cache.erase(it);
+                    break;
+                }
+            }
+        }
+        cache.push_back(std::unique_ptr<ConvolverWorkspace>(new ConvolverWorkspace(chunksize)));
+        workspace = cache.back().get();
+    }
+    workspace->in_use_ = true;
+    return workspace;
+}
+
+void ConvolverWorkspace::release() {
+    in_use_ = false;
+    // the real and complex buffers of a chunk, for the input and for the result
+    const size_t kChunkBytes =
+        2 * (sizeof(float) * chunksize_ + sizeof(fftwf_complex) * chunksize_complex_);
+    const size_t kKept = kMaxIdleChunkBytes / kChunkBytes;
+    if (chunks_.size() > kKept) {
+        chunks_.resize(kKept);
+        chunks_complex_.resize(kKept);
+        result_chunks_.resize(kKept);
+        result_chunks_complex_.resize(kKept);
+    }
+}
+
+void ConvolverWorkspace::batchForward(FloatSignal& fs, ComplexSignal& cs, const size_t howmany) {
+    std::unique_ptr<FftBatchForwardPlan>& plan = batch_plans_[howmany];
+    if (!plan) {
+        plan.reset(new FftBatchForwardPlan(fs, cs, chunksize_, howmany));
+    }
+    plan->execute(fs, cs);
+}
+
+void ConvolverWorkspace::reserveChunks(const size_t num_chunks) {
+    while (chunks_.size() < num_chunks) {
+        chunks_.emplace_back(new FloatSignal(chunksize_));
+        chunks_complex_.emplace_back(new ComplexSignal(chunksize_complex_));
+        result_chunks_.emplace_back(new FloatSignal(chunksize_));
+        result_chunks_complex_.emplace_back(new ComplexSignal(chunksize_complex_));
+    }
+}
+
+OverlapSaveGeometry::OverlapSaveGeometry(const size_t signal_size, const size_t patch_size)
+    : signal_size(signal_size),
+    patch_size(patch_size),
+    result_size(signal_size + patch_size - 1),
+    chunksize(2 * Pow2Ceil(patch_size)),
+    chunksize_complex(chunksize / 2 + 1),
+    stride(chunksize - patch_size + 1) {
+    const size_t kPaddedSignalSize = (patch_size - 1) + signal_size +
+        (chunksize - (result_size % stride));
+    num_chunks = (kPaddedSignalSize - chunksize) / stride + 1;
+}
+
+PreparedSignal::PreparedSignal(const SignalView& signal, const size_t patch_size)
+    : geometry_(signal.getSize(), patch_size) {
+    check_a_less_equal_b(patch_size, signal.getSize(),
+        "PreparedSignal: len(signal) can't be smaller than len(patch)!");
+    for (size_t i = 0; i < geometry_.num_chunks; i++) {
+        chunks_complex_.emplace_back(new ComplexSignal(geometry_.chunksize_complex));
+    }
+    // the workspace provides the plan and the aligned real buffers to chunk the signal into
+    ConvolverWorkspace* workspace = ConvolverWorkspace::Acquire(geometry_.chunksize);
+    workspace->reserveChunks(geometry_.num_chunks);
+#ifdef WITH_OPENMP_ABOVE
+#pragma omp parallel for schedule(static, WITH_OPENMP_ABOVE)
+#endif
+    for (long long i = 0; i < (long long)geometry_.num_chunks; i++) {
+        FloatSignal& chunk = workspace->getChunk(i);
+        signal.copyZeroPadded(geometry_.chunkOffset(i), chunk.getData(), geometry_.chunksize);
+        workspace->forward(chunk, *chunks_complex_[i]);
+    }
+    workspace->release();
 }
 
 void MakeAndExportFftwWisdom(const std::string path_out, const size_t min_2pow,
@@ -52,11 +317,16 @@ void MakeAndExportFftwWisdom(const std::string path_out, const size_t min_2pow,
         FftForwardPlan fwd(fs, cs);
         FftBackwardPlan bwd(cs, fs);
     }
+    std::lock_guard<std::mutex> lock(FftwPlannerMutex());
     fftwf_export_wisdom_to_filename(path_out.c_str());
 }
 
 void ImportFftwWisdom(const std::string path_in, const bool throw_exception_if_fail) {
-    int result = fftwf_import_wisdom_from_filename(path_in.c_str());
+    int result = 0;
+    {
+        std::lock_guard<std::mutex> lock(FftwPlannerMutex());
+        result = fftwf_import_wisdom_from_filename(path_in.c_str());
+    }
     if (result != 0) {
         std::cout << "[ImportFftwWisdom] succesfully imported " << path_in << std::endl;
     }
@@ -67,3 +337,197 @@ void ImportFftwWisdom(const std::string path_in, const bool throw_exception_if_f
         else { std::cout << "WARNING: " << message; }
     }
 }
+
+void UpdateXcorrPeak(const float* chunk, const size_t chunk_index, const size_t stride,
+    const size_t result_size, const size_t begin, const size_t end, const float scale,
+    XcorrPeak& peak) {
+    const size_t kChunkBegin = chunk_index * stride;
+    const size_t kFrom = std::max(kChunkBegin, begin);
+    const size_t kTo = std::min(std::min(kChunkBegin + stride, result_size), end);
+    for (size_t i = kFrom; i < kTo; ++i) {
+        const float kValue = chunk[i - kChunkBegin] * scale;
+        if (kValue > peak.value) {
+            peak.value = kValue;
+            peak.index = i;
+        }
+    }
+}
+
+void CollectXcorrBucketPeaks(const float* chunk, const size_t chunk_index, const size_t stride,
+    const size_t result_size, const size_t begin, const size_t end, const float scale,
+    const size_t bucket_size, std::vector<XcorrPeak>& bucket_peaks) {
+    const size_t kChunkBegin = chunk_index * stride;
+    const size_t kFrom = std::max(kChunkBegin, begin);
+    const size_t kTo = std::min(std::min(kChunkBegin + stride, result_size), end);
+    for (size_t bucket_begin = kFrom; bucket_begin < kTo; ) {
+        const size_t kBucketEnd = std::min((bucket_begin / bucket_size + 1) * bucket_size, kTo);
+        XcorrPeak peak = { bucket_begin, 0.0f };
+        UpdateXcorrPeak(chunk, chunk_index, stride, result_size, bucket_begin, kBucketEnd,
+            scale, peak);
+        if (peak.value > 0) { bucket_peaks.push_back(peak); }
+        bucket_begin = kBucketEnd;
+    }
+}
+
+std::vector<XcorrPeak> SelectXcorrPeaks(const std::vector<std::vector<XcorrPeak>>& bucket_peaks,
+    const size_t k, const size_t min_distance) {
+    // merge the per-chunk lists, joining the buckets that were split by a chunk boundary
+    std::vector<XcorrPeak> candidates;
+    const size_t kBucketSize = std::max(min_distance, (size_t)1);
+    for (auto& chunk_peaks : bucket_peaks) {
+        for (auto& peak : chunk_peaks) {
+            if (!candidates.empty() &&
+                candidates.back().index / kBucketSize == peak.index / kBucketSize) {
+                if (peak.value > candidates.back().value) { candidates.back() = peak; }
+            } else {
+                candidates.push_back(peak);
+            }
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+        [](const XcorrPeak& a, const XcorrPeak& b) { return a.value > b.value; });
+    std::vector<XcorrPeak> selected;
+    for (auto& candidate : candidates) {
+        if (selected.size() >= k) { break; }
+        bool too_close = false;
+        for (auto& peak : selected) {
+            const size_t kDistance = candidate.index > peak.index ?
+                candidate.index - peak.index : peak.index - candidate.index;
+            too_close |= kDistance < min_distance;
+        }
+        if (!too_close) { selected.push_back(candidate); }
+    }
+    return selected;
+}
+
+XcorrPeak OverlapSaveConvolver::executeXcorrPeak(const size_t begin, const size_t end) {
+    ConvolverWorkspace& ws = *workspace_;
+    __transform_and_multiply(true);
+    std::vector<XcorrPeak> chunk_peaks(num_chunks_, XcorrPeak{ begin, 0.0f });
+    const float kScale = 1.0f / (float)result_chunksize_;
+#ifdef WITH_OPENMP_ABOVE
+#pragma omp parallel for schedule(static, WITH_OPENMP_ABOVE)
+#endif
+    for (long long i = 0; i < (long long)num_chunks_; i++) {
+        ws.backward(ws.getResultChunkComplex(i), ws.getResultChunk(i));
+        UpdateXcorrPeak(ws.getResultChunk(i).getData(), i, result_stride_, result_size_,
+            begin, end, kScale, chunk_peaks[i]);
+    }
+    _state_ = State::kUninitialized;
+    // in chunk order, so that the first of several equal maxima wins like in a linear scan
+    XcorrPeak peak = { begin, 0.0f };
+    for (auto& chunk_peak : chunk_peaks) {
+        if (chunk_peak.value > peak.value) { peak = chunk_peak; }
+    }
+    return peak;
+}
+
+std::vector<XcorrPeak> OverlapSaveConvolver::executeXcorrPeaks(const size_t k,
+    const size_t min_distance, const size_t begin, const size_t end) {
+    ConvolverWorkspace& ws = *workspace_;
+    __transform_and_multiply(true);
+    std::vector<std::vector<XcorrPeak>> bucket_peaks(num_chunks_);
+    const float kScale = 1.0f / (float)result_chunksize_;
+    const size_t kBucketSize = std::max(min_distance, (size_t)1);
+#ifdef WITH_OPENMP_ABOVE
+#pragma omp parallel for schedule(static, WITH_OPENMP_ABOVE)
+#endif
+    for (long long i = 0; i < (long long)num_chunks_; i++) {
+        ws.backward(ws.getResultChunkComplex(i), ws.getResultChunk(i));
+        CollectXcorrBucketPeaks(ws.getResultChunk(i).getData(), i, result_stride_, result_size_,
+            begin, end, kScale, kBucketSize, bucket_peaks[i]);
+    }
+    _state_ = State::kUninitialized;
+    return SelectXcorrPeaks(bucket_peaks, k, min_distance);
+}
+
+std::vector<XcorrPeak> BatchXcorrPeaks(const PreparedSignal& signal,
+    const std::vector<SignalView>& patches, const size_t begin, const size_t end) {
+    const OverlapSaveGeometry& kGeometry = signal.getGeometry();
+    const size_t kNumPatches = patches.size();
+    std::vector<XcorrPeak> peaks(kNumPatches, XcorrPeak{ begin, 0.0f });
+    if (kNumPatches == 0) { return peaks; }
+    for (auto& patch : patches) {
+        CheckAllEqual({ patch.getSize(), kGeometry.patch_size },
+            "BatchXcorrPeaks: len(patch) must match the PreparedSignal");
+    }
+
+    // pad all the patches into one array and transform them at once, with the batch plan cached
+    // in the workspace; only its plans are used, its buffers stay untouched
+    const size_t kChunkSize = kGeometry.chunksize;
+    const size_t kChunkSizeComplex = kGeometry.chunksize_complex;
+    FloatSignal padded_patches(kChunkSize * kNumPatches);
+    ComplexSignal patches_complex(kChunkSizeComplex * kNumPatches);
+    for (size_t p = 0; p < kNumPatches; ++p) {
+        patches[p].copyZeroPadded(0, padded_patches.getData() + p * kChunkSize, kChunkSize);
+    }
+    ConvolverWorkspace* workspace = ConvolverWorkspace::Acquire(kChunkSize);
+    workspace->batchForward(padded_patches, patches_complex, kNumPatches);
+
+    const float kScale = 1.0f / (float)kChunkSize;
+#ifdef WITH_OPENMP_ABOVE
+#pragma omp parallel
+#endif
+    {
+        // per-thread scratch for one chunk
+        ComplexSignal product(kChunkSizeComplex);
+        FloatSignal xcorr(kChunkSize);
+#ifdef WITH_OPENMP_ABOVE
+#pragma omp for schedule(dynamic, 1)
+#endif
+        for (long long p = 0; p < (long long)kNumPatches; ++p) {
+            const fftwf_complex* patch_complex = patches_complex.getData() + p * kChunkSizeComplex;
+            XcorrPeak peak = peaks[p];
+            for (size_t i = 0; i < kGeometry.num_chunks; ++i) {
+                SpectralCorrelation(signal.getChunkComplex(i).getData(), patch_complex,
+                    product.getData(), kChunkSizeComplex);
+                workspace->backward(product, xcorr);
+                UpdateXcorrPeak(xcorr.getData(), i, kGeometry.stride, kGeometry.result_size,
+                    begin, end, kScale, peak);
+            }
+            peaks[p] = peak;
+        }
+    }
+    workspace->release();
+
+    return peaks;
+}
+
+void NormalizedCrossCorrelationPeaks(const SignalView& a, const SignalView& b,
+    XcorrPeak* a_peak, XcorrPeak* b_peak) {
+    CheckAllEqual({ a.getSize(), b.getSize() },
+        "NormalizedCrossCorrelationPeaks: both views must have the same length");
+    const size_t size = a.getSize();
+    *a_peak = { 0, 0.0f };
+    *b_peak = { 0, 0.0f };
+    if (size == 0) { return; }
+    // same chunk size as an overlap-save correlation with a patch of this length, which leaves
+    // at least size-1 zeros after each array so that the circular correlation doesn't wrap
+    const size_t kFftSize = 2 * Pow2Ceil(size);
+    ConvolverWorkspace* workspace = ConvolverWorkspace::Acquire(kFftSize);
+    workspace->reserveChunks(1);
+    FloatSignal& padded_a = workspace->getChunk(0);
+    FloatSignal& padded_b = workspace->getPatch();
+    NormalizeSignal(a, padded_a.getData());
+    NormalizeSignal(b, padded_b.getData());
+    memset(padded_a.getData() + size, 0, sizeof(float) * (kFftSize - size));
+    memset(padded_b.getData() + size, 0, sizeof(float) * (kFftSize - size));
+
+    workspace->forward(padded_a, workspace->getChunkComplex(0));
+    workspace->forward(padded_b, workspace->getPatchComplex());
+    SpectralCorrelation(workspace->getChunkComplex(0), workspace->getPatchComplex(),
+        workspace->getResultChunkComplex(0));
+    FloatSignal& xcorr = workspace->getResultChunk(0);
+    workspace->backward(workspace->getResultChunkComplex(0), xcorr);
+
+    // xcorr[s] = dot(b, a[s:]) and xcorr[kFftSize-s] = dot(a, b[s:])
+    const float kScale = 1.0f / ((float)kFftSize * (float)size);
+    const float* data = xcorr.getData();
+    for (size_t lag = 1; lag < size; ++lag) {
+        const float kAValue = data[lag] * kScale;
+        const float kBValue = data[kFftSize - lag] * kScale;
+        if (kAValue > a_peak->value) { *a_peak = { lag, kAValue }; }
+        if (kBValue > b_peak->value) { *b_peak = { lag, kBValue }; }
+    }
+    workspace->release();
+}
@@ -8,7 +8,13 @@
 #define REAL 0
 #define IMAG 1
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
 #include <vector>
@@ -19,6 +25,10 @@
 
 size_t Pow2Ceil(size_t x);
 
+// FFTW only guarantees that the fftwf_execute* family is thread-safe. Everything that touches the
+// planner (creating and destroying plans, importing wisdom) has to hold this lock.
+std::mutex& FftwPlannerMutex();
+
 // Given a container or its beginning and end iterables, checks wether all values contained in the
 // iterable are equal and raises an exception if not. Usage example:
 // vector<size_t> v1({});
@@ -87,6 +97,10 @@ public:
     explicit Signal(T* data, size_t size) : data_(data), size_(size) {
         memset(data_, 0, sizeof(T) * size);
     }
+    // This constructor leaves the contents of the array untouched, for the classes that wrap
+    // existing data instead of allocating their own.
+    struct KeepContents {};
+    explicit Signal(T* data, size_t size, KeepContents) : data_(data), size_(size) {}
     // The destructor is empty because this class didn't allocate the contained array
     virtual ~Signal() {}
     // getters
@@ -106,13 +120,30 @@ public:
     }
 };
 
+// Computes the mean and standard deviation of the array in one pass, see FloatSignal::meanStd.
+void SignalMeanStd(const float* data, const size_t size, float* mean, float* std);
+
+// Writes the z-scored src array, (x - mean) / (std * divisor), into dst, which may be src itself
+// or any other array of at least the same size. A constant array (std=0) is written as zeros.
+void NormalizeSignal(const float* src, const size_t size, float* dst, const float divisor = 1.0f);
+
 // This class is a Signal that works on aligned float arrays allocated by FFTW.
 // It also overloads some further operators to do basic arithmetic
+// Instead of owning its array, a FloatSignal can also wrap external storage (see Wrap), such as
+// an array decoded by ffmpeg or a part of another signal, to avoid copying it.
 class FloatSignal : public Signal<float> {
+private:
+    // whether data_ was allocated by this signal, and has to be freed with it
+    bool owns_data_;
+    // keeps the wrapped storage alive for as long as the signal exists, if needed
+    std::shared_ptr<const void> backing_;
+
+    explicit FloatSignal(float* data, size_t size, std::shared_ptr<const void> backing)
+        : Signal(data, size, KeepContents()), owns_data_(false), backing_(std::move(backing)) {}
 public:
     // the basic constructor allocates an aligned, float array, which is zeroed by the superclass
     explicit FloatSignal(size_t size)
-        : Signal(fftwf_alloc_real(size), size) {}
+        : Signal(fftwf_alloc_real(size), size), owns_data_(true) {}
     explicit FloatSignal(float* data, size_t size) : FloatSignal(size) {
         memcpy(data_, data, sizeof(float) * size);
     }
@@ -120,40 +151,98 @@ public:
         : FloatSignal(size + pad_bef + pad_aft) {
         memcpy(data_ + pad_bef, data, sizeof(float) * size);
     }
-    // the destructor frees the only resource allocated
-    ~FloatSignal() { fftwf_free(data_); }
+    // Returns a signal that works directly on the given array, without copying it. The array isn't
+    // freed by the signal: if backing is given, the signal keeps a reference to it and releases it
+    // on destruction (for example, a malloc'ed buffer with free as deleter). Otherwise the array
+    // must outlive the signal.
+    // Note that operations that modify the signal modify the wrapped array as well.
+    static FloatSignal* Wrap(float* data, size_t size,
+        std::shared_ptr<const void> backing = nullptr) {
+        return new FloatSignal(data, size, std::move(backing));
+    }
+    // the destructor frees the only resource allocated, or releases the wrapped storage
+    ~FloatSignal() {
+        if (owns_data_) { fftwf_free(data_); }
+    }
+    FloatSignal(const FloatSignal&) = delete;
+    FloatSignal& operator=(const FloatSignal&) = delete;
+    bool ownsData() const { return owns_data_; }
+    // Wrapped arrays may not have the alignment that FFTW uses for its SIMD code (owned ones
+    // always do). This copies the data into an owned, aligned array only if that's the case.
+    void makeAligned() {
+        if (fftwf_alignment_of(data_) == 0) { return; }
+        float* aligned = fftwf_alloc_real(size_);
+        memcpy(aligned, data_, sizeof(float) * size_);
+        data_ = aligned;
+        owns_data_ = true;
+        backing_.reset();
+    }
     void operator+=(const float x) { for (size_t i = 0; i < size_; ++i) { data_[i] += x; } }
     void operator-=(const float x) { for (size_t i = 0; i < size_; ++i) { data_[i] -= x; } }
     void operator*=(const float x) { for (size_t i = 0; i < size_; ++i) { data_[i] *= x; } }
     void operator/=(const float x) { for (size_t i = 0; i < size_; ++i) { data_[i] /= x; } }
+    // Computes the mean and the (population) standard deviation in a single pass over the data.
+    // The sums are accumulated in double precision and vectorized where possible.
+    void meanStd(float* mean, float* std) const;
     float mean() const {
-        float value_sum = 0.0f;
-        size_t size = size_;
-        float* data = data_;
-
-        for (size_t i = 0; i < size; ++i) {
-            value_sum += data[i];
-        }
-
-        const float result = value_sum / size;
-        return result;
+        float mean, std;
+        meanStd(&mean, &std);
+        return mean;
     }
-
     float std() const {
-        const float mean = this->mean();
-        size_t size = size_;
-        float* data = data_;
-        float result = 0;
-
-        for (size_t i = 0; i < size; ++i) {
-            float a = fabs(data[i] - mean);
-            result += a * a;
-        }
-        result = sqrtf(result / size);
-        return result;
+        float mean, std;
+        meanStd(&mean, &std);
+        return std;
     }
+    // Z-scores the signal in place, that is, x = (x - mean) / (std * divisor). Same as
+    // *this -= mean(); *this /= (std() * divisor); but in two passes over the data instead of six.
+    void normalize(const float divisor = 1.0f) { NormalizeSignal(data_, size_, data_, divisor); }
 };
 
+// A read-only view of part of a signal's samples, optionally followed by a tail of zeros: the first
+// getDataSize() samples are read from the array, and the rest up to getSize() are zeros. It doesn't
+// own nor copy anything, so it is cheap to make and to pass by value, and slicing a signal never
+// allocates. The zeros aren't stored anywhere either: they are only written out when the view is
+// copied into an FFT buffer (see copyZeroPadded). The viewed signal must outlive the view.
+class SignalView {
+private:
+    const float* data_;
+    size_t data_size_;
+    size_t size_;
+public:
+    SignalView() : data_(nullptr), data_size_(0), size_(0) {}
+    // a view of size samples of the array, followed by padding zeros
+    SignalView(const float* data, const size_t size, const size_t padding = 0)
+        : data_(data), data_size_(size), size_(size + padding) {}
+    // a view of the whole signal. Not explicit, so that signals can be passed as views
+    SignalView(const FloatSignal& signal)
+        : SignalView(signal.getData(), signal.getSize()) {}
+    // getters
+    const float* getData() const { return data_; }
+    size_t getDataSize() const { return data_size_; }
+    size_t getSize() const { return size_; }
+    float operator[](const size_t idx) const { return idx < data_size_ ? data_[idx] : 0.0f; }
+    // Returns the view of the range [start, start+size). Whatever part of it lies past the end of
+    // the data reads as zeros, even if it runs past the end of this view.
+    SignalView slice(const size_t start, const size_t size) const {
+        if (start >= data_size_) { return SignalView(nullptr, 0, size); }
+        const size_t kDataSize = std::min(size, data_size_ - start);
+        return SignalView(data_ + start, kDataSize, size - kDataSize);
+    }
+    // Copies the range [offset, offset+dst_size) of the view into dst, see CopyZeroPadded.
+    void copyZeroPadded(const long long offset, float* dst, const size_t dst_size) const;
+    // Same as FloatSignal::meanStd, counting the padding zeros as samples.
+    void meanStd(float* mean, float* std) const;
+};
+
+// Writes the z-scored view, padding included, into the first src.getSize() entries of dst.
+void NormalizeSignal(const SignalView& src, float* dst, const float divisor = 1.0f);
+
+// Returns the loudness envelope of the view at 1/factor of its rate: the mean absolute value of
+// every block of factor samples (the last one may be shorter), padding included, with the mean of
+// the envelope subtracted so that cross-correlating envelopes isn't biased towards loud parts.
+FloatSignal* DecimatedEnvelope(const SignalView& src, const size_t factor);
+
 // This class is a Signal that works on aligned complex (float[2]) arrays allocated by FFTW.
 // It also overloads some further operators to do basic arithmetic
 class ComplexSignal : public Signal<fftwf_complex> {
@@ -188,14 +277,21 @@ public:
 // It is not expected to be used directly: rather, to be extended by specific plans, for instance,
 // if working with real, 1D signals, only 1D complex<->real plans are needed.
 class FftPlan {
-private:
+protected:
     fftwf_plan plan_;
 public:
     explicit FftPlan(fftwf_plan p) : plan_(p) {}
-    virtual ~FftPlan() { fftwf_destroy_plan(plan_); }
+    virtual ~FftPlan() {
+        std::lock_guard<std::mutex> lock(FftwPlannerMutex());
+        fftwf_destroy_plan(plan_);
+    }
     void execute() { fftwf_execute(plan_); }
 };
 
+// Wrappers for the FFTW 1D real planners that hold the FftwPlannerMutex while planning.
+fftwf_plan PlanDftR2c1d(int n, float* in, fftwf_complex* out, unsigned flags);
+fftwf_plan PlanDftC2r1d(int n, fftwf_complex* in, float* out, unsigned flags);
+
 // This forward plan (1D, R->C) is adequate to process 1D floats (real).
 class FftForwardPlan : public FftPlan {
 public:
@@ -205,9 +301,16 @@ public:
     // this condition doesn't hold. Since the signals and the superclass already have proper
     // destructors, no special memory management has to be done.
     explicit FftForwardPlan(FloatSignal& fs, ComplexSignal& cs)
-        : FftPlan(fftwf_plan_dft_r2c_1d((int)fs.getSize(), fs.getData(), cs.getData(), FFTW_ESTIMATE)) {
+        : FftPlan(PlanDftR2c1d((int)fs.getSize(), fs.getData(), cs.getData(), FFTW_ESTIMATE)) {
         CheckRealComplexRatio(fs.getSize(), cs.getSize(), "FftForwardPlan");
     }
+    // Runs the plan on a different pair of signals through FFTW's new-array interface. They must
+    // have the same sizes as the ones the plan was made with, and be allocated by FFTW as well
+    // so that the alignment matches.
+    void execute(FloatSignal& fs, ComplexSignal& cs) {
+        fftwf_execute_dft_r2c(plan_, fs.getData(), cs.getData());
+    }
+    using FftPlan::execute;
 };
 
 // This backward plan (1D, C->R) is adequate to process spectra of 1D floats (real).
@@ -219,22 +322,56 @@ public:
     // this condition doesn't hold. Since the signals and the superclass already have proper
     // destructors, no special memory management has to be done.
     explicit FftBackwardPlan(ComplexSignal& cs, FloatSignal& fs)
-        : FftPlan(fftwf_plan_dft_c2r_1d((int)fs.getSize(), cs.getData(), fs.getData(), FFTW_ESTIMATE)) {
+        : FftPlan(PlanDftC2r1d((int)fs.getSize(), cs.getData(), fs.getData(), FFTW_ESTIMATE)) {
         CheckRealComplexRatio(fs.getSize(), cs.getSize(), "FftBackwardPlan");
     }
+    // Same as FftForwardPlan::execute(fs, cs). Note that a C->R transform destroys its input.
+    void execute(ComplexSignal& cs, FloatSignal& fs) {
+        fftwf_execute_dft_c2r(plan_, cs.getData(), fs.getData());
+    }
+    using FftPlan::execute;
+};
+
+// This plan performs <HOWMANY> forward 1D R->C transforms of size <N> in one go, as described in
+// FFTW's advanced interface. The real signal holds the inputs one after the other (so its size
+// must be howmany*n) and the complex one gets the spectra the same way, howmany*(n/2+1).
+class FftBatchForwardPlan : public FftPlan {
+public:
+    explicit FftBatchForwardPlan(FloatSignal& fs, ComplexSignal& cs, const size_t n,
+        const size_t howmany);
+    // Same as FftForwardPlan::execute(fs, cs), for signals of the sizes the plan was made with.
+    void execute(FloatSignal& fs, ComplexSignal& cs) {
+        fftwf_execute_dft_r2c(plan_, fs.getData(), cs.getData());
+    }
+    using FftPlan::execute;
 };
 
 // This free function takes three complex signals a,b,c of the same size and computes the complex
 // element-wise multiplication:   a+ib * c+id = ac+iad+ibc-bd = ac-bd + i(ad+bc)   The computation
 // loop isn't sent to OMP because this function itself is already expected to be called by multiple
-// threads, and it would actually slow down the process.
-// It throuws an exception if
+// threads, and it would actually slow down the process. Instead, it runs the widest SIMD kernel
+// that the CPU supports (see signals_simd.h).
+// It throuws an exception if the sizes differ.
 void SpectralConvolution(const ComplexSignal& a, const ComplexSignal& b, ComplexSignal& result);
 
 // This function behaves identically to SpectralConvolution, but computes c=a*conj(b) instead
 // of c=a*b:         a * conj(b) = a+ib * c-id = ac-iad+ibc+bd = ac+bd + i(bc-ad)
 void SpectralCorrelation(const ComplexSignal& a, const ComplexSignal& b, ComplexSignal& result);
 
+// Unchecked versions of the two functions above, for spectra that don't live in their own
+// ComplexSignal (for example, one of many transforms packed in a single array).
+void SpectralConvolution(const fftwf_complex* a, const fftwf_complex* b, fftwf_complex* result,
+    const size_t size);
+void SpectralCorrelation(const fftwf_complex* a, const fftwf_complex* b, fftwf_complex* result,
+    const size_t size);
+
+// Plain scalar versions of the unchecked functions above. They are the reference that the SIMD
+// kernels have to agree with, and the fallback when no SIMD kernel can be used.
+void SpectralConvolutionScalar(const fftwf_complex* a, const fftwf_complex* b,
+    fftwf_complex* result, const size_t size);
+void SpectralCorrelationScalar(const fftwf_complex* a, const fftwf_complex* b,
+    fftwf_complex* result, const size_t size);
+
 // This function is a small script that calculates the FFT wisdom for all powers of two (since those
 // are the only expected sizes to be used with the FFTs), and exports it to the given path. The
 // wisdom is a brute-force search of the most efficient implementations for the FFTs: It takes a
@@ -252,6 +389,131 @@ void ImportFftwWisdom(const std::string path_in, const bool throw_exception_if_f
 /// PERFORM CONVOLUTION/CORRELATION
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Copies the range [offset, offset+dst_size) of the src array into dst. The range may begin
+// before 0 or run past src_size: those positions are filled with zeros instead. This is the same
+// as slicing a zero-padded copy of src, without having to make the padded copy.
+void CopyZeroPadded(const float* src, const size_t src_size, const long long offset,
+    float* dst, const size_t dst_size);
+
+// This class holds everything that the overlap-save algorithm (see OverlapSaveConvolver) needs for
+// a given chunk size X and that doesn't depend on the data: a forward and a backward plan, which
+// are run on every buffer through FFTW's new-array interface, the padded patch and its spectrum,
+// and one set of buffers per signal chunk. Planning and allocating this is much more expensive
+// than a single correlation, so workspaces are kept alive in a small per-thread cache and handed
+// out with Acquire(). The chunk buffers grow as needed, so a workspace can be reused for any
+// signal length, and are trimmed back when it goes idle, so that a thread that once correlated a
+// long signal doesn't hold on to its buffers for good. A workspace is only used by one convolver
+// at a time: if the cached one is in use, Acquire() makes another one.
+class ConvolverWorkspace {
+private:
+    size_t chunksize_;
+    size_t chunksize_complex_;
+    bool in_use_;
+    FloatSignal patch_;
+    ComplexSignal patch_complex_;
+    std::vector<std::unique_ptr<FloatSignal>> chunks_;
+    std::vector<std::unique_ptr<ComplexSignal>> chunks_complex_;
+    std::vector<std::unique_ptr<FloatSignal>> result_chunks_;
+    std::vector<std::unique_ptr<ComplexSignal>> result_chunks_complex_;
+    FftForwardPlan forward_plan_;
+    FftBackwardPlan backward_plan_;
+    // batch forward plans of the chunk size, by number of transforms, see batchForward()
+    std::map<size_t, std::unique_ptr<FftBatchForwardPlan>> batch_plans_;
+public:
+    // Maximum number of idle workspaces that each thread keeps around.
+    static const size_t kMaxCachedPerThread = 4;
+    // Maximum size of the chunk buffers that an idle workspace keeps, release() frees the rest.
+    static const size_t kMaxIdleChunkBytes = 4 << 20;
+
+    explicit ConvolverWorkspace(const size_t chunksize);
+    // Returns an idle workspace of the given chunk size from the calling thread's cache, creating
+    // it if needed, and marks it as in use until release() is called. Never returns nullptr.
+    static ConvolverWorkspace* Acquire(const size_t chunksize);
+    void release();
+    // Makes sure that there are buffers for at least num_chunks chunks.
+    void reserveChunks(const size_t num_chunks);
+
+    size_t getChunkSize() const { return chunksize_; }
+    size_t getChunkSizeComplex() const { return chunksize_complex_; }
+    FloatSignal& getPatch() { return patch_; }
+    ComplexSignal& getPatchComplex() { return patch_complex_; }
+    FloatSignal& getChunk(const size_t i) { return *chunks_[i]; }
+    ComplexSignal& getChunkComplex(const size_t i) { return *chunks_complex_[i]; }
+    FloatSignal& getResultChunk(const size_t i) { return *result_chunks_[i]; }
+    ComplexSignal& getResultChunkComplex(const size_t i) { return *result_chunks_complex_[i]; }
+    // FFT(fs)->cs and IFFT(cs)->fs with the cached plans. Any buffers of this workspace can be
+    // passed, and both may be called from several threads at the same time.
+    void forward(FloatSignal& fs, ComplexSignal& cs) { forward_plan_.execute(fs, cs); }
+    void backward(ComplexSignal& cs, FloatSignal& fs) { backward_plan_.execute(cs, fs); }
+    // FFT of howmany chunks at once, laid out like in FftBatchForwardPlan. The batch plan is made
+    // (and the sizes checked) the first time a number of chunks is transformed, and reused after
+    // that. Unlike forward(), this may only be called from the thread that acquired the workspace.
+    void batchForward(FloatSignal& fs, ComplexSignal& cs, const size_t howmany);
+};
+
+// The measurements of the overlap-save algorithm (see OverlapSaveConvolver) for a signal of length
+// S and a patch of length P: chunk size X, stride L between chunks and the number of chunks needed
+// to cover the signal padded with (P-1) zeros before and (X-U%L) zeros after, being U=S+P-1.
+struct OverlapSaveGeometry {
+    size_t signal_size;
+    size_t patch_size;
+    size_t result_size;
+    size_t chunksize;
+    size_t chunksize_complex;
+    size_t stride;
+    size_t num_chunks;
+    OverlapSaveGeometry(const size_t signal_size, const size_t patch_size);
+    // Offset of the i-th chunk with respect to the beginning of the unpadded signal.
+    long long chunkOffset(const size_t i) const {
+        return (long long)(i * stride) - (long long)(patch_size - 1);
+    }
+};
+
+// This class holds the forward FFT of every chunk of a signal (steps 2 and 3 of the overlap-save
+// algorithm). The chunking only depends on the length of the patch, so once a signal has been
+// prepared for a patch length, it can be correlated or convolved with any number of patches of
+// that length by passing it to OverlapSaveConvolver, and the signal is only transformed once.
+// It keeps its own copy of the spectra, so the original signal may be freed afterwards.
+class PreparedSignal {
+private:
+    OverlapSaveGeometry geometry_;
+    std::vector<std::unique_ptr<ComplexSignal>> chunks_complex_;
+public:
+    // Note that len(signal) can never be smaller than patch_size, or an exception is thrown.
+    PreparedSignal(const SignalView& signal, const size_t patch_size);
+    const OverlapSaveGeometry& getGeometry() const { return geometry_; }
+    const ComplexSignal& getChunkComplex(const size_t i) const { return *chunks_complex_[i]; }
+};
+
+// A maximum of a cross-correlation: index into the result as returned by
+// OverlapSaveConvolver::extractResult(), and the value found there.
+struct XcorrPeak {
+    size_t index;
+    float value;
+};
+
+// Scans the part of the i-th cross-correlation chunk of the overlap-save algorithm that ends up
+// in the result (see OverlapSaveConvolver::extractResult) for values greater than peak.value,
+// restricted to the result indices [begin, end), and updates the peak with the first of the
+// largest ones. The chunk doesn't have to be normalized yet: the values are multiplied by scale
+// as they are read, instead of dividing the whole chunk by the FFT size beforehand.
+void UpdateXcorrPeak(const float* chunk, const size_t chunk_index, const size_t stride,
+    const size_t result_size, const size_t begin, const size_t end, const float scale,
+    XcorrPeak& peak);
+
+// Same as UpdateXcorrPeak, but appends the maximum of every bucket of <BUCKET_SIZE> result
+// indices that the chunk touches (bucket b covers [b*bucket_size, (b+1)*bucket_size)) to the
+// given vector, in increasing order. Only values greater than 0 are considered.
+void CollectXcorrBucketPeaks(const float* chunk, const size_t chunk_index, const size_t stride,
+    const size_t result_size, const size_t begin, const size_t end, const float scale,
+    const size_t bucket_size, std::vector<XcorrPeak>& bucket_peaks);
+
+// Given the bucket maxima of a whole cross-correlation, as collected by CollectXcorrBucketPeaks,
+// returns up to k of them in descending order of value, such that no two are closer than
+// min_distance (a greedy non-maximum suppression). Bucket maxima split across chunks are merged.
+std::vector<XcorrPeak> SelectXcorrPeaks(const std::vector<std::vector<XcorrPeak>>& bucket_peaks,
+    const size_t k, const size_t min_distance);
+
 // This class performs an efficient version of the spectral convolution/cross-correlation between
 // two 1D float arrays, <SIGNAL> and <PATCH>, called overlap-save:
 // http://www.comm.utoronto.ca/~dkundur/course_info/real-time-DSP/notes/8_Kundur_Overlap_Save_Add.pdf
@@ -269,29 +531,31 @@ void ImportFftwWisdom(const std::string path_in, const bool throw_exception_if_f
 //   6. Concatenate the resulting chunks, ignoring (P-1) samples per chunk
 // Note that steps 3,4,5 may be parallelized with some significant gain in performance.
 // In this class: X = result_chunksize, L = result_stride
+// The plans and buffers are borrowed from a ConvolverWorkspace for the lifetime of the convolver,
+// so constructing one doesn't plan or allocate anything once the workspace for X is cached.
 class OverlapSaveConvolver {
 private:
     // grab input lengths
     size_t signal_size_;
     size_t patch_size_;
     size_t result_size_;
-    // make padded copies of the inputs and get chunk measurements
-    FloatSignal padded_patch_;
+    // chunk measurements
     size_t result_chunksize_;
     size_t result_chunksize_complex_;
     size_t result_stride_;
-    ComplexSignal padded_patch_complex_;
-    // padded copy of the signal
-    FloatSignal padded_signal_;
-    // the deconstructed signal
-    std::vector<FloatSignal*> s_chunks_;
-    std::vector<ComplexSignal*> s_chunks_complex_;
+    size_t num_chunks_;
+    // the plans, the padded patch and the chunks of the padded signal, plus their spectra and
     // the corresponding chunks holding convs/xcorrs
-    std::vector<FloatSignal*> result_chunks_;
-    std::vector<ComplexSignal*> result_chunks_complex_;
-    // the corresponding plans (plus the plan of the patch)
-    std::vector<FftForwardPlan*> forward_plans_;
-    std::vector<FftBackwardPlan*> backward_plans_;
+    ConvolverWorkspace* workspace_;
+    // if the convolver was built from a PreparedSignal, the spectra of the signal chunks are
+    // taken from it instead of from the workspace, and step 3 is skipped for them
+    const PreparedSignal* prepared_;
+
+    // the spectrum of the i-th signal chunk, wherever it comes from
+    const ComplexSignal& __chunk_complex(const size_t i) {
+        if (prepared_ != nullptr) { return prepared_->getChunkComplex(i); }
+        return workspace_->getChunkComplex(i);
+    }
 
     // Basic state management to prevent getters from being called prematurely.
     // Also to adapt the extractResult getter, since Conv and Xcorr padding behaves differently
@@ -307,78 +571,101 @@ private:
         }
     }
 
-    // This private method implements steps 3,4,5 of the algorithm. If the given flag is false,
+    // This private method implements steps 3 and 4 of the algorithm. If the given flag is false,
     // it will perform a convolution (4a), and a cross-correlation (4b) otherwise.
     // Note the parallelization with OpenMP, which increases performance in supporting CPUs.
-    void __execute(const bool cross_correlate) {
-        auto operation = (cross_correlate) ? SpectralCorrelation : SpectralConvolution;
+    void __transform_and_multiply(const bool cross_correlate) {
+        void (*operation)(const ComplexSignal&, const ComplexSignal&, ComplexSignal&) =
+            SpectralConvolution;
+        if (cross_correlate) { operation = SpectralCorrelation; }
+        ConvolverWorkspace& ws = *workspace_;
 
         // do ffts
+        ws.forward(ws.getPatch(), ws.getPatchComplex());
+        if (prepared_ == nullptr) {
 #ifdef WITH_OPENMP_ABOVE
 #pragma omp parallel for schedule(static, WITH_OPENMP_ABOVE)
 #endif
-        for (long long i = 0; i < (long long)forward_plans_.size(); i++) {
-            forward_plans_.at(i)->execute();
+            for (long long i = 0; i < (long long)num_chunks_; i++) {
+                ws.forward(ws.getChunk(i), ws.getChunkComplex(i));
+            }
         }
         // multiply spectra
 #ifdef WITH_OPENMP_ABOVE
 #pragma omp parallel for schedule(static, WITH_OPENMP_ABOVE)
 #endif
-        for (long long i = 0; i < (long long)result_chunks_.size(); i++) {
-            operation(*s_chunks_complex_.at(i), this->padded_patch_complex_, *result_chunks_complex_.at(i));
+        for (long long i = 0; i < (long long)num_chunks_; i++) {
+            operation(__chunk_complex(i), ws.getPatchComplex(), ws.getResultChunkComplex(i));
         }
+    }
+
+    // This private method implements steps 3,4,5 of the algorithm, see __transform_and_multiply.
+    void __execute(const bool cross_correlate) {
+        ConvolverWorkspace& ws = *workspace_;
+        __transform_and_multiply(cross_correlate);
         // do iffts
 #ifdef WITH_OPENMP_ABOVE
 #pragma omp parallel for schedule(static, WITH_OPENMP_ABOVE)
 #endif
-        for (long long i = 0; i < (long long)result_chunks_.size(); i++) {
-            backward_plans_.at(i)->execute();
-            *result_chunks_.at(i) /= (float)result_chunksize_;
+        for (long long i = 0; i < (long long)num_chunks_; i++) {
+            ws.backward(ws.getResultChunkComplex(i), ws.getResultChunk(i));
+            ws.getResultChunk(i) /= (float)result_chunksize_;
         }
     }
 
 public:
-    // The only constructor for the class, receives two signals and performs steps 1 and 2 of the
-    // algorithm on them. The signals are passed by reference but the class works with padded copies
-    // of them, so no care has to be taken regarding memory management.
+    // This constructor receives two signals and performs steps 1 and 2 of the algorithm on them.
+    // The signals are passed as views but the class works with padded copies of them, so no
+    // care has to be taken regarding memory management.
     // The wisdomPath may be empty, or a path to a valid wisdom file.
     // Note that len(signal) can never be smaller than len(patch), or an exception is thrown.
-    OverlapSaveConvolver(FloatSignal& signal, FloatSignal& patch, const std::string wisdomPath = "")
-        : signal_size_(signal.getSize()),
-        patch_size_(patch.getSize()),
-        result_size_(signal_size_ + patch_size_ - 1),
-        //
-        padded_patch_(patch.getData(), patch_size_, 0, 2 * Pow2Ceil(patch_size_) - patch_size_),
-        result_chunksize_(padded_patch_.getSize()),
-        result_chunksize_complex_(result_chunksize_ / 2 + 1),
-        result_stride_(result_chunksize_ - patch_size_ + 1),
-        padded_patch_complex_(result_chunksize_complex_),
+    OverlapSaveConvolver(const SignalView& signal, const SignalView& patch,
+        const std::string wisdomPath = "")
+        : OverlapSaveConvolver(OverlapSaveGeometry(signal.getSize(), patch.getSize()), nullptr,
+            patch, wisdomPath) {
+        // chunk the signal into strides of same size as padded patch. The padded signal would be
+        // (P-1) zeros, the signal, and enough zeros to fill the last chunk. It isn't materialized:
+        // every chunk is copied straight out of the signal instead.
+        for (size_t i = 0; i < num_chunks_; i++) {
+            const long long offset = (long long)(i * result_stride_) - (long long)(patch_size_ - 1);
+            signal.copyZeroPadded(offset, workspace_->getChunk(i).getData(), result_chunksize_);
+        }
+    }
+    // This constructor reuses the chunk spectra of an already prepared signal, so only the patch
+    // is transformed when executing. The patch must have the length the signal was prepared for,
+    // or an exception is thrown. The PreparedSignal must outlive the convolver.
+    OverlapSaveConvolver(const PreparedSignal& signal, const SignalView& patch)
+        : OverlapSaveConvolver(signal.getGeometry(), &signal, patch, "") {}
+private:
+    // Performs step 1, and gets the workspace ready for as many chunks as the geometry needs.
+    OverlapSaveConvolver(const OverlapSaveGeometry& geometry, const PreparedSignal* prepared,
+        const SignalView& patch, const std::string wisdomPath)
+        : signal_size_(geometry.signal_size),
+        patch_size_(geometry.patch_size),
+        result_size_(geometry.result_size),
         //
-        padded_signal_(signal.getData(), signal_size_, patch_size_ - 1, result_chunksize_ - (result_size_ % result_stride_)),
+        result_chunksize_(geometry.chunksize),
+        result_chunksize_complex_(geometry.chunksize_complex),
+        result_stride_(geometry.stride),
+        num_chunks_(geometry.num_chunks),
+        workspace_(nullptr),
+        prepared_(prepared),
         _state_(State::kUninitialized) {
         // end of initializer list, now check that len(signal)>=len(patch)
         check_a_less_equal_b(patch_size_, signal_size_,
             "OverlapSaveConvolver: len(signal) can't be smaller than len(patch)!");
+        // a PreparedSignal is chunked for one specific patch length
+        CheckAllEqual({ patch_size_, patch.getSize() },
+            "OverlapSaveConvolver: len(patch) must match the PreparedSignal");
         // and load the wisdom if required. If unsuccessful, no exception thrown, just print a warning.
+        // This has to happen before the workspace makes its plans for the first time.
         if (!wisdomPath.empty()) { ImportFftwWisdom(wisdomPath, false); }
-        // chunk the signal into strides of same size as padded patch
-        // and make complex counterparts too, as well as the corresponding xcorr signals
-        for (size_t i = 0; i <= padded_signal_.getSize() - result_chunksize_; i += result_stride_) {
-            s_chunks_.push_back(new FloatSignal(&padded_signal_[i], result_chunksize_));
-            s_chunks_complex_.push_back(new ComplexSignal(result_chunksize_complex_));
-            result_chunks_.push_back(new FloatSignal(result_chunksize_));
-            result_chunks_complex_.push_back(new ComplexSignal(result_chunksize_complex_));
-        }
-        // make one forward plan per signal chunk, and one for the patch
-        // Also backward plans for the xcorr chunks
-        forward_plans_.push_back(new FftForwardPlan(padded_patch_, padded_patch_complex_));
-        for (size_t i = 0; i < s_chunks_.size(); i++) {
-            forward_plans_.push_back(new FftForwardPlan(*s_chunks_.at(i), *s_chunks_complex_.at(i)));
-            backward_plans_.push_back(new FftBackwardPlan(*result_chunks_complex_.at(i),
-                *result_chunks_.at(i)));
-        }
+        workspace_ = ConvolverWorkspace::Acquire(result_chunksize_);
+        workspace_->reserveChunks(num_chunks_);
+        // pad the patch
+        patch.copyZeroPadded(0, workspace_->getPatch().getData(), result_chunksize_);
     }
-
+public:
     //
     void executeConv() {
         __execute(false);
@@ -388,11 +675,24 @@ public:
         __execute(true);
         _state_ = State::kXcorr;
     }
+    // These methods compute the cross-correlation like executeXcorr(), but reduce every chunk as
+    // soon as it has been inverse-transformed instead of keeping it for extractResult(), so the
+    // full-length result is never allocated, normalized or copied. Both only look at the result
+    // indices [begin, end), with the same indexing as extractResult().
+    // executeXcorrPeak() returns the first maximum greater than 0, or {begin, 0} if there is none.
+    // executeXcorrPeaks() returns up to k maxima greater than 0, in descending order of value and
+    // no closer than min_distance to each other.
+    // After any of them, extractResult() and printChunks() can't be called until executeXcorr()
+    // or executeConv() is.
+    XcorrPeak executeXcorrPeak(const size_t begin, const size_t end);
+    std::vector<XcorrPeak> executeXcorrPeaks(const size_t k, const size_t min_distance,
+        const size_t begin, const size_t end);
+    size_t getResultSize() const { return result_size_; }
     // getting info from the convolfer
     void printChunks(const std::string name = "convolver") {
         __check_last_executed_not_null("printChunks");
-        for (size_t i = 0; i < result_chunks_.size(); i++) {
-            result_chunks_.at(i)->print(name + "_chunk_" + std::to_string(i));
+        for (size_t i = 0; i < num_chunks_; i++) {
+            workspace_->getResultChunk(i).print(name + "_chunk_" + std::to_string(i));
         }
     }
 
@@ -425,9 +725,8 @@ public:
         FloatSignal* result = new FloatSignal(result_size_);
         float* result_arr = result->getData(); // not const because of memcpy
         // fill!
-        size_t kNumChunks = result_chunks_.size();
-        for (size_t i = 0; i < kNumChunks; i++) {
-            float* xc_arr = result_chunks_.at(i)->getData();
+        for (size_t i = 0; i < num_chunks_; i++) {
+            float* xc_arr = workspace_->getResultChunk(i).getData();
             const size_t kBegin = i * result_stride_;
             // if the last chunk goes above result_size_, reduce copy size. else copy_size=result_stride_
             size_t copy_size = result_stride_;
@@ -437,29 +736,37 @@ public:
         return result;
     }
 
+    // the workspace goes back to the thread's cache, with its plans and buffers
     ~OverlapSaveConvolver() {
-        // clear vectors holding signals
-        for (size_t i = 0; i < s_chunks_.size(); i++) {
-            delete (s_chunks_.at(i));
-            delete (s_chunks_complex_.at(i));
-            delete (result_chunks_.at(i));
-            delete (result_chunks_complex_.at(i));
-        }
-        s_chunks_.clear();
-        s_chunks_complex_.clear();
-        result_chunks_.clear();
-        result_chunks_complex_.clear();
-        // clear vector holding forward FFT plans
-        for (size_t i = 0; i < forward_plans_.size(); i++) {
-            delete (forward_plans_.at(i));
-        }
-        forward_plans_.clear();
-        // clear vector holding backward FFT plans
-        for (size_t i = 0; i < backward_plans_.size(); i++) {
-            delete (backward_plans_.at(i));
-        }
-        backward_plans_.clear();
+        workspace_->release();
     }
+    OverlapSaveConvolver(const OverlapSaveConvolver&) = delete;
+    OverlapSaveConvolver& operator=(const OverlapSaveConvolver&) = delete;
 };
 
+// Cross-correlates a whole batch of patches against the same prepared signal, and returns the
+// peak of each cross-correlation within the result indices [begin, end). All the patches must
+// have the length the signal was prepared for, or an exception is thrown.
+// The patches are transformed together with a single batch plan, which is cached with the other
+// plans of the chunk size (see ConvolverWorkspace::batchForward). Then every patch is correlated
+// with all the chunks of the signal on its own thread, so the parallelism grows with the number of
+// patches instead of being limited by the number of chunks. The full cross-correlations are never
+// stored: each inverse-transformed chunk is scanned for its maximum and then discarded. If no value
+// in the range is greater than 0, the peak is {begin, 0}.
+std::vector<XcorrPeak> BatchXcorrPeaks(const PreparedSignal& signal,
+    const std::vector<SignalView>& patches, const size_t begin, const size_t end);
+
+// Computes the normalized cross-correlation of two views of the same length (an exception is
+// thrown otherwise), padding included: both are z-scored and their cross-correlation is divided
+// by the length, which makes it the Pearson correlation of the overlapping parts, weighted by how
+// much they overlap, at every lag.
+// Lag s compares b with a[s:] (b is delayed by s with respect to a) in a_peak, and a with b[s:]
+// in b_peak. Each one gets the first maximum greater than 0 for lags s in [1, size), with
+// the lag as its index, or {0, 0} if there is none.
+// Both directions are read from the same full-lag result, so it only takes one forward FFT per
+// array and a single inverse one, of size 2*Pow2Ceil(size). The views are normalized straight
+// into the (cached, see ConvolverWorkspace) FFT buffers, so nothing is copied or allocated.
+void NormalizedCrossCorrelationPeaks(const SignalView& a, const SignalView& b,
+    XcorrPeak* a_peak, XcorrPeak* b_peak);
+
 #endif // SIGNALS_H
@@ -0,0 +1,318 @@
+#include "signals_simd.h"
+#include "signals.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIGNALS_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only allow intrinsics of the instruction sets enabled for the function, MSVC
+// allows all of them everywhere.
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+void SignalMomentsScalar(const float* data, const size_t size, const float shift,
+    double* sum, double* sum_squares) {
+    // independent accumulators, so consecutive additions don't wait for each other
+    double sums[4] = { 0, 0, 0, 0 };
+    double squares[4] = { 0, 0, 0, 0 };
+    const size_t kUnrolled = size - size % 4;
+    for (size_t i = 0; i < kUnrolled; i += 4) {
+        for (size_t j = 0; j < 4; ++j) {
+            const double kValue = (double)data[i + j] - shift;
+            sums[j] += kValue;
+            squares[j] += kValue * kValue;
+        }
+    }
+    for (size_t i = kUnrolled; i < size; ++i) {
+        const double kValue = (double)data[i] - shift;
+        sums[0] += kValue;
+        squares[0] += kValue * kValue;
+    }
+    *sum += (sums[0] + sums[1]) + (sums[2] + sums[3]);
+    *sum_squares += (squares[0] + squares[1]) + (squares[2] + squares[3]);
+}
+
+#ifdef SIGNALS_SIMD_X86
+
+// All the kernels work on interleaved [re, im] pairs, several complex numbers per register:
+//   a * b       = (ar*br - ai*bi) + i(ai*br + ar*bi)
+//   a * conj(b) = (ar*br + ai*bi) + i(ai*br - ar*bi)
+// With b_re = [br, br], b_im = [bi, bi] and a_swap = [ai, ar], both are a*b_re -/+ a_swap*b_im,
+// subtracting in the real lanes and adding in the imaginary ones (or the opposite for conj).
+// Whatever doesn't fill a whole register is left to the scalar reference.
+
+static void SpectralConvolutionSse2(const fftwf_complex* a, const fftwf_complex* b,
+    fftwf_complex* result, const size_t size) {
+    const float* pa = (const float*)a;
+    const float* pb = (const float*)b;
+    float* pr = (float*)result;
+    // flips the sign of the real lanes
+    const __m128 kSign = _mm_set_ps(0.0f, -0.0f, 0.0f, -0.0f);
+    const size_t kVectorized = size - size % 2;
+    for (size_t i = 0; i < kVectorized; i += 2) {
+        const __m128 va = _mm_loadu_ps(pa + 2 * i);
+        const __m128 vb = _mm_loadu_ps(pb + 2 * i);
+        const __m128 b_re = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 2, 0, 0));
+        const __m128 b_im = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 3, 1, 1));
+        const __m128 a_swap = _mm_shuffle_ps(va, va, _MM_SHUFFLE(2, 3, 0, 1));
+        const __m128 cross = _mm_xor_ps(_mm_mul_ps(a_swap, b_im), kSign);
+        _mm_storeu_ps(pr + 2 * i, _mm_add_ps(_mm_mul_ps(va, b_re), cross));
+    }
+    SpectralConvolutionScalar(a + kVectorized, b + kVectorized, result + kVectorized,
+        size - kVectorized);
+}
+
+static void SpectralCorrelationSse2(const fftwf_complex* a, const fftwf_complex* b,
+    fftwf_complex* result, const size_t size) {
+    const float* pa = (const float*)a;
+    const float* pb = (const float*)b;
+    float* pr = (float*)result;
+    // flips the sign of the imaginary lanes
+    const __m128 kSign = _mm_set_ps(-0.0f, 0.0f, -0.0f, 0.0f);
+    const size_t kVectorized = size - size % 2;
+    for (size_t i = 0; i < kVectorized; i += 2) {
+        const __m128 va = _mm_loadu_ps(pa + 2 * i);
+        const __m128 vb = _mm_loadu_ps(pb + 2 * i);
+        const __m128 b_re = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 2, 0, 0));
+        const __m128 b_im = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 3, 1, 1));
+        const __m128 a_swap = _mm_shuffle_ps(va, va, _MM_SHUFFLE(2, 3, 0, 1));
+        const __m128 cross = _mm_xor_ps(_mm_mul_ps(a_swap, b_im), kSign);
+        _mm_storeu_ps(pr + 2 * i, _mm_add_ps(_mm_mul_ps(va, b_re), cross));
+    }
+    SpectralCorrelationScalar(a + kVectorized, b + kVectorized, result + kVectorized,
+        size - kVectorized);
+}
+
+SIMD_TARGET("avx2,fma")
+static void SpectralConvolutionAvx2(const fftwf_complex* a, const fftwf_complex* b,
+    fftwf_complex* result, const size_t size) {
+    const float* pa = (const float*)a;
+    const float* pb = (const float*)b;
+    float* pr = (float*)result;
+    const size_t kVectorized = size - size % 4;
+    for (size_t i = 0; i < kVectorized; i += 4) {
+        const __m256 va = _mm256_loadu_ps(pa + 2 * i);
+        const __m256 vb = _mm256_loadu_ps(pb + 2 * i);
+        const __m256 b_re = _mm256_moveldup_ps(vb);
+        const __m256 b_im = _mm256_movehdup_ps(vb);
+        const __m256 a_swap = _mm256_permute_ps(va, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm256_storeu_ps(pr + 2 * i,
+            _mm256_fmaddsub_ps(va, b_re, _mm256_mul_ps(a_swap, b_im)));
+    }
+    SpectralConvolutionScalar(a + kVectorized, b + kVectorized, result + kVectorized,
+        size - kVectorized);
+}
+
+SIMD_TARGET("avx2,fma")
+static void SpectralCorrelationAvx2(const fftwf_complex* a, const fftwf_complex* b,
+    fftwf_complex* result, const size_t size) {
+    const float* pa = (const float*)a;
+    const float* pb = (const float*)b;
+    float* pr = (float*)result;
+    const size_t kVectorized = size - size % 4;
+    for (size_t i = 0; i < kVectorized; i += 4) {
+        const __m256 va = _mm256_loadu_ps(pa + 2 * i);
+        const __m256 vb = _mm256_loadu_ps(pb + 2 * i);
+        const __m256 b_re = _mm256_moveldup_ps(vb);
+        const __m256 b_im = _mm256_movehdup_ps(vb);
+        const __m256 a_swap = _mm256_permute_ps(va, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm256_storeu_ps(pr + 2 * i,
+            _mm256_fmsubadd_ps(va, b_re, _mm256_mul_ps(a_swap, b_im)));
+    }
+    SpectralCorrelationScalar(a + kVectorized, b + kVectorized, result + kVectorized,
+        size - kVectorized);
+}
+
+SIMD_TARGET("avx512f")
+static void SpectralConvolutionAvx512(const fftwf_complex* a, const fftwf_complex* b,
+    fftwf_complex* result, const size_t size) {
+    const float* pa = (const float*)a;
+    const float* pb = (const float*)b;
+    float* pr = (float*)result;
+    const size_t kVectorized = size - size % 8;
+    for (size_t i = 0; i < kVectorized; i += 8) {
+        const __m512 va = _mm512_loadu_ps(pa + 2 * i);
+        const __m512 vb = _mm512_loadu_ps(pb + 2 * i);
+        const __m512 b_re = _mm512_moveldup_ps(vb);
+        const __m512 b_im = _mm512_movehdup_ps(vb);
+        const __m512 a_swap = _mm512_permute_ps(va, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm512_storeu_ps(pr + 2 * i,
+            _mm512_fmaddsub_ps(va, b_re, _mm512_mul_ps(a_swap, b_im)));
+    }
+    SpectralConvolutionScalar(a + kVectorized, b + kVectorized, result + kVectorized,
+        size - kVectorized);
+}
+
+SIMD_TARGET("avx512f")
+static void SpectralCorrelationAvx512(const fftwf_complex* a, const fftwf_complex* b,
+    fftwf_complex* result, const size_t size) {
+    const float* pa = (const float*)a;
+    const float* pb = (const float*)b;
+    float* pr = (float*)result;
+    const size_t kVectorized = size - size % 8;
+    for (size_t i = 0; i < kVectorized; i += 8) {
+        const __m512 va = _mm512_loadu_ps(pa + 2 * i);
+        const __m512 vb = _mm512_loadu_ps(pb + 2 * i);
+        const __m512 b_re = _mm512_moveldup_ps(vb);
+        const __m512 b_im = _mm512_movehdup_ps(vb);
+        const __m512 a_swap = _mm512_permute_ps(va, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm512_storeu_ps(pr + 2 * i,
+            _mm512_fmsubadd_ps(va, b_re, _mm512_mul_ps(a_swap, b_im)));
+    }
+    SpectralCorrelationScalar(a + kVectorized, b + kVectorized, result + kVectorized,
+        size - kVectorized);
+}
+
+// The moments kernels widen the floats to doubles and keep two accumulators of each kind.
+
+static void SignalMomentsSse2(const float* data, const size_t size, const float shift,
+    double* sum, double* sum_squares) {
+    const __m128d kShift = _mm_set1_pd(shift);
+    __m128d sums[2] = { _mm_setzero_pd(), _mm_setzero_pd() };
+    __m128d squares[2] = { _mm_setzero_pd(), _mm_setzero_pd() };
+    const size_t kVectorized = size - size % 4;
+    for (size_t i = 0; i < kVectorized; i += 4) {
+        const __m128 values = _mm_loadu_ps(data + i);
+        const __m128d low = _mm_sub_pd(_mm_cvtps_pd(values), kShift);
+        const __m128d high = _mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(values, values)), kShift);
+        sums[0] = _mm_add_pd(sums[0], low);
+        sums[1] = _mm_add_pd(sums[1], high);
+        squares[0] = _mm_add_pd(squares[0], _mm_mul_pd(low, low));
+        squares[1] = _mm_add_pd(squares[1], _mm_mul_pd(high, high));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(sums[0], sums[1]));
+    *sum += lanes[0] + lanes[1];
+    _mm_storeu_pd(lanes, _mm_add_pd(squares[0], squares[1]));
+    *sum_squares += lanes[0] + lanes[1];
+    SignalMomentsScalar(data + kVectorized, size - kVectorized, shift, sum, sum_squares);
+}
+
+SIMD_TARGET("avx2,fma")
+static void SignalMomentsAvx2(const float* data, const size_t size, const float shift,
+    double* sum, double* sum_squares) {
+    const __m256d kShift = _mm256_set1_pd(shift);
+    __m256d sums[2] = { _mm256_setzero_pd(), _mm256_setzero_pd() };
+    __m256d squares[2] = { _mm256_setzero_pd(), _mm256_setzero_pd() };
+    const size_t kVectorized = size - size % 8;
+    for (size_t i = 0; i < kVectorized; i += 8) {
+        const __m256d low = _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(data + i)), kShift);
+        const __m256d high = _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(data + i + 4)), kShift);
+        sums[0] = _mm256_add_pd(sums[0], low);
+        sums[1] = _mm256_add_pd(sums[1], high);
+        squares[0] = _mm256_fmadd_pd(low, low, squares[0]);
+        squares[1] = _mm256_fmadd_pd(high, high, squares[1]);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(sums[0], sums[1]));
+    *sum += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm256_storeu_pd(lanes, _mm256_add_pd(squares[0], squares[1]));
+    *sum_squares += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    SignalMomentsScalar(data + kVectorized, size - kVectorized, shift, sum, sum_squares);
+}
+
+SIMD_TARGET("avx512f")
+static void SignalMomentsAvx512(const float* data, const size_t size, const float shift,
+    double* sum, double* sum_squares) {
+    const __m512d kShift = _mm512_set1_pd(shift);
+    __m512d sums[2] = { _mm512_setzero_pd(), _mm512_setzero_pd() };
+    __m512d squares[2] = { _mm512_setzero_pd(), _mm512_setzero_pd() };
+    const size_t kVectorized = size - size % 16;
+    for (size_t i = 0; i < kVectorized; i += 16) {
+        const __m512d low = _mm512_sub_pd(_mm512_cvtps_pd(_mm256_loadu_ps(data + i)), kShift);
+        const __m512d high = _mm512_sub_pd(_mm512_cvtps_pd(_mm256_loadu_ps(data + i + 8)), kShift);
+        sums[0] = _mm512_add_pd(sums[0], low);
+        sums[1] = _mm512_add_pd(sums[1], high);
+        squares[0] = _mm512_fmadd_pd(low, low, squares[0]);
+        squares[1] = _mm512_fmadd_pd(high, high, squares[1]);
+    }
+    *sum += _mm512_reduce_add_pd(_mm512_add_pd(sums[0], sums[1]));
+    *sum_squares += _mm512_reduce_add_pd(_mm512_add_pd(squares[0], squares[1]));
+    SignalMomentsScalar(data + kVectorized, size - kVectorized, shift, sum, sum_squares);
+}
+
+#ifdef _MSC_VER
+// CPUID leaf 1 ECX: OSXSAVE (27), AVX (28), FMA (12). Leaf 7 EBX: AVX2 (5), AVX512F (16).
+// XCR0 tells which register files the OS saves: SSE+AVX (bits 1,2), AVX-512 (bits 5,6,7).
+static SimdLevel DetectSimdLevel() {
+    int info[4];
+    __cpuid(info, 0);
+    const int kMaxLeaf = info[0];
+    __cpuid(info, 1);
+    const bool kOsxsave = (info[2] & (1 << 27)) != 0;
+    const bool kAvx = (info[2] & (1 << 28)) != 0;
+    const bool kFma = (info[2] & (1 << 12)) != 0;
+    const bool kSse2 = (info[3] & (1 << 26)) != 0;
+    bool avx2 = false;
+    bool avx512f = false;
+    if (kMaxLeaf >= 7) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+        avx512f = (info[1] & (1 << 16)) != 0;
+    }
+    const unsigned long long kXcr0 = kOsxsave ? _xgetbv(0) : 0;
+    const bool kOsAvx = (kXcr0 & 0x6) == 0x6;
+    const bool kOsAvx512 = (kXcr0 & 0xe6) == 0xe6;
+    if (avx512f && kOsAvx512) { return SimdLevel::kAvx512; }
+    if (avx2 && kAvx && kFma && kOsAvx) { return SimdLevel::kAvx2; }
+    if (kSse2) { return SimdLevel::kSse2; }
+    return SimdLevel::kScalar;
+}
+#else
+// __builtin_cpu_supports already takes into account whether the OS enabled the registers.
+static SimdLevel DetectSimdLevel() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) { return SimdLevel::kAvx512; }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) { return SimdLevel::kAvx2; }
+    if (__builtin_cpu_supports("sse2")) { return SimdLevel::kSse2; }
+    return SimdLevel::kScalar;
+}
+#endif
+
+#else
+
+static SimdLevel DetectSimdLevel() { return SimdLevel::kScalar; }
+
+#endif // SIGNALS_SIMD_X86
+
+SimdLevel GetSimdLevel() {
+    static const SimdLevel kLevel = DetectSimdLevel();
+    return kLevel;
+}
+
+SpectralKernels GetSpectralKernels(const SimdLevel level) {
+    switch (level) {
+#ifdef SIGNALS_SIMD_X86
+    case SimdLevel::kAvx512:
+        return { SpectralConvolutionAvx512, SpectralCorrelationAvx512 };
+    case SimdLevel::kAvx2:
+        return { SpectralConvolutionAvx2, SpectralCorrelationAvx2 };
+    case SimdLevel::kSse2:
+        return { SpectralConvolutionSse2, SpectralCorrelationSse2 };
+#endif
+    default:
+        return { SpectralConvolutionScalar, SpectralCorrelationScalar };
+    }
+}
+
+MomentsKernel GetMomentsKernel(const SimdLevel level) {
+    switch (level) {
+#ifdef SIGNALS_SIMD_X86
+    case SimdLevel::kAvx512:
+        return SignalMomentsAvx512;
+    case SimdLevel::kAvx2:
+        return SignalMomentsAvx2;
+    case SimdLevel::kSse2:
+        return SignalMomentsSse2;
+#endif
+    default:
+        return SignalMomentsScalar;
+    }
+}
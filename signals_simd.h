@@ -0,0 +1,45 @@
+#ifndef SIGNALS_SIMD_H
+#define SIGNALS_SIMD_H
+
+#include <cstddef>
+#include <fftw3.h>
+
+// Vectorized versions of the element-wise complex products used by SpectralConvolution and
+// SpectralCorrelation, for the x86 instruction sets below. Every kernel is compiled regardless of
+// the compiler flags, and the one to use is picked at runtime depending on what the CPU supports,
+// so a single binary runs everywhere and still uses AVX-512 where it's available.
+// On other architectures, only the scalar kernels exist.
+
+// The instruction sets that there are kernels for, from worst to best.
+enum class SimdLevel { kScalar, kSse2, kAvx2, kAvx512 };
+
+// Returns the best level supported by both the CPU and the OS (which has to save the wide
+// registers on context switches). Detection only runs once.
+SimdLevel GetSimdLevel();
+
+// Same signature as the unchecked SpectralConvolution/SpectralCorrelation in signals.h.
+typedef void (*SpectralKernel)(const fftwf_complex* a, const fftwf_complex* b,
+    fftwf_complex* result, const size_t size);
+
+struct SpectralKernels {
+    SpectralKernel convolution; // result = a * b
+    SpectralKernel correlation; // result = a * conj(b)
+};
+
+// Returns the kernels for the given level. Calling kernels of a level above GetSimdLevel() will
+// crash with an illegal instruction. The results may differ from the scalar reference in the last
+// bits, since the AVX kernels use fused multiply-adds.
+SpectralKernels GetSpectralKernels(const SimdLevel level);
+
+// Accumulates sum(x - shift) and sum((x - shift)^2) over the data, in double precision, and adds
+// them to *sum and *sum_squares. Shifting by a value close to the mean (the first sample is good
+// enough for audio) avoids the cancellation of the naive sum-of-squares formula.
+typedef void (*MomentsKernel)(const float* data, const size_t size, const float shift,
+    double* sum, double* sum_squares);
+
+// The scalar reference for MomentsKernel, and the kernel for the given level.
+void SignalMomentsScalar(const float* data, const size_t size, const float shift,
+    double* sum, double* sum_squares);
+MomentsKernel GetMomentsKernel(const SimdLevel level);
+
+#endif // SIGNALS_SIMD_H
@@ -0,0 +1,71 @@
+#include "taskscheduler.h"
+#include <mutex>
+#include <QThreadPool>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// decoding a few thumbnails at a time is enough to keep up with scrolling
+#define THUMBNAIL_THREADS 2
+// threads of the global pool that a search never reserves
+#define RESERVATION_HEADROOM 1
+
+static QThreadPool *thumbnailPool()
+{
+    static QThreadPool *pool = nullptr;
+    static std::once_flag once;
+    std::call_once(once, []() {
+        pool = new QThreadPool();
+        pool->setMaxThreadCount(THUMBNAIL_THREADS);
+    });
+    return pool;
+}
+
+void TaskScheduler::start(QRunnable *task, Priority priority)
+{
+    if (priority == VisibleThumbnailPriority) {
+        thumbnailPool()->start(task);
+    } else {
+        QThreadPool::globalInstance()->start(task, priority);
+    }
+}
+
+// Searches often start at the same time (one per cluster), and if two of them counted the idle
+// threads before either reserved them, both would reserve the same threads. The pool counts
+// reserved threads as active, so counting and reserving under this lock is enough.
+static std::mutex &reservationMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+OpenMpThreadReservation::OpenMpThreadReservation()
+    : reserved(0), previousThreadCount(1)
+{
+    QThreadPool *pool = QThreadPool::globalInstance();
+    {
+        std::lock_guard<std::mutex> lock(reservationMutex());
+        // the calling thread is already counted as active
+        const int idle = pool->maxThreadCount() - pool->activeThreadCount() - RESERVATION_HEADROOM;
+        for (int i = 0; i < idle; ++i) {
+            pool->reserveThread();
+            reserved++;
+        }
+    }
+#ifdef _OPENMP
+    previousThreadCount = omp_get_max_threads();
+    omp_set_num_threads(threadCount());
+#endif
+}
+
+OpenMpThreadReservation::~OpenMpThreadReservation()
+{
+#ifdef _OPENMP
+    omp_set_num_threads(previousThreadCount);
+#endif
+    QThreadPool *pool = QThreadPool::globalInstance();
+    std::lock_guard<std::mutex> lock(reservationMutex());
+    for (int i = 0; i < reserved; ++i) {
+        pool->releaseThread();
+    }
+}
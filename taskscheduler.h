@@ -0,0 +1,43 @@
+#ifndef TASKSCHEDULER_H
+#define TASKSCHEDULER_H
+
+#include <QRunnable>
+
+// Runs the background work of the application on the global thread pool, with priorities: queued
+// tasks of a higher priority are started first, so that a long queue of files to load doesn't
+// delay the search. The thumbnails of what is on screen have a small pool of their own, so that
+// they never wait for a thread, whatever the search has taken (see OpenMpThreadReservation).
+class TaskScheduler
+{
+public:
+    enum Priority {
+        // loading the audio of the files
+        IngestPriority = 0,
+        // looking for the intro
+        SearchPriority = 1,
+        // thumbnails of the items that are on screen
+        VisibleThumbnailPriority = 2
+    };
+
+    static void start(QRunnable *task, Priority priority);
+};
+
+// Lets the OpenMP regions of the calling pool thread use the cores that the pool isn't using at the
+// moment, and keeps the pool from using them for as long as this exists, so that the pool threads
+// and the OpenMP threads together never outnumber the cores. Without it, every OpenMP region would
+// start a thread per core on top of all the busy pool threads. RESERVATION_HEADROOM threads are
+// left to the pool, so that other searches queued meanwhile can still start.
+class OpenMpThreadReservation
+{
+public:
+    OpenMpThreadReservation();
+    ~OpenMpThreadReservation();
+    int threadCount() const { return reserved + 1; }
+
+private:
+    int reserved;
+    // what the OpenMP regions of the thread used before, put back when done
+    int previousThreadCount;
+};
+
+#endif // TASKSCHEDULER_H
@@ -0,0 +1,132 @@
+// Checks every SIMD kernel that the CPU can run against the scalar reference, for all the sizes
+// up to a few registers (so every possible tail is covered) and a few large odd ones, on aligned
+// and unaligned data. Prints the failures and returns non-zero if there are any.
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "../../signals.h"
+#include "../../signals_simd.h"
+
+// the AVX kernels use fused multiply-adds, so they may round differently than the reference
+#define PRODUCT_TOLERANCE 1e-5f
+#define MOMENTS_TOLERANCE 1e-9
+
+static const char* LevelName(const SimdLevel level) {
+    switch (level) {
+    case SimdLevel::kAvx512:
+        return "AVX-512";
+    case SimdLevel::kAvx2:
+        return "AVX2";
+    case SimdLevel::kSse2:
+        return "SSE2";
+    default:
+        return "scalar";
+    }
+}
+
+static std::vector<size_t> TestSizes() {
+    std::vector<size_t> sizes;
+    // an AVX-512 register holds 8 complex numbers, so this covers every tail length several times
+    for (size_t size = 0; size <= 67; ++size) {
+        sizes.push_back(size);
+    }
+    sizes.push_back(255);
+    sizes.push_back(1023);
+    sizes.push_back(4097);
+    sizes.push_back(65537);
+    return sizes;
+}
+
+// Runs the kernel and the reference on the same random spectra, starting offset elements into the
+// arrays, and returns how many results differ by more than the tolerance.
+static int CompareSpectralKernel(const char* name, const SimdLevel level, SpectralKernel kernel,
+    SpectralKernel reference, const size_t size, const size_t offset, std::mt19937& random) {
+    std::uniform_real_distribution<float> distribution(-100.0f, 100.0f);
+    std::vector<float> a(2 * (size + offset));
+    std::vector<float> b(2 * (size + offset));
+    for (size_t i = 0; i < a.size(); ++i) {
+        a[i] = distribution(random);
+        b[i] = distribution(random);
+    }
+    // one more element than needed, to catch writes past the end
+    std::vector<float> expected(2 * (size + offset + 1), 0.0f);
+    std::vector<float> actual(2 * (size + offset + 1), 0.0f);
+    reference((const fftwf_complex*)a.data() + offset, (const fftwf_complex*)b.data() + offset,
+        (fftwf_complex*)expected.data() + offset, size);
+    kernel((const fftwf_complex*)a.data() + offset, (const fftwf_complex*)b.data() + offset,
+        (fftwf_complex*)actual.data() + offset, size);
+
+    int failures = 0;
+    for (size_t i = 0; i < expected.size(); ++i) {
+        const size_t kIndex = i / 2;
+        // the products go up to 2*100*100, the tolerance is relative to that
+        const float kScale = 2 * 100.0f * 100.0f;
+        if (std::fabs(expected[i] - actual[i]) > PRODUCT_TOLERANCE * kScale) {
+            if (failures == 0) {
+                fprintf(stderr, "%s %s, size %zu, offset %zu: element %zu is %g instead of %g\n",
+                    LevelName(level), name, size, offset, kIndex, actual[i], expected[i]);
+            }
+            failures++;
+        }
+    }
+    return failures;
+}
+
+static int CompareMomentsKernel(const SimdLevel level, MomentsKernel kernel, const size_t size,
+    const size_t offset, std::mt19937& random) {
+    std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+    std::vector<float> data(size + offset);
+    for (float& value : data) {
+        value = distribution(random);
+    }
+    const float kShift = data.empty() ? 0.0f : data[0];
+    double expected_sum = 0;
+    double expected_squares = 0;
+    double actual_sum = 0;
+    double actual_squares = 0;
+    SignalMomentsScalar(data.data() + offset, size, kShift, &expected_sum, &expected_squares);
+    kernel(data.data() + offset, size, kShift, &actual_sum, &actual_squares);
+
+    // the kernels only add in a different order
+    const double kScale = (double)size + 1;
+    if (std::fabs(expected_sum - actual_sum) > MOMENTS_TOLERANCE * kScale ||
+        std::fabs(expected_squares - actual_squares) > MOMENTS_TOLERANCE * kScale) {
+        fprintf(stderr, "%s moments, size %zu, offset %zu: %g, %g instead of %g, %g\n",
+            LevelName(level), size, offset, actual_sum, actual_squares, expected_sum,
+            expected_squares);
+        return 1;
+    }
+    return 0;
+}
+
+int main() {
+    std::mt19937 random(12345);
+    const SimdLevel kBest = GetSimdLevel();
+    const SimdLevel kLevels[] = { SimdLevel::kSse2, SimdLevel::kAvx2, SimdLevel::kAvx512 };
+    const std::vector<size_t> kSizes = TestSizes();
+
+    int failures = 0;
+    for (const SimdLevel level : kLevels) {
+        if (level > kBest) {
+            printf("%s: not supported by this CPU, skipped\n", LevelName(level));
+            continue;
+        }
+        const SpectralKernels kKernels = GetSpectralKernels(level);
+        const MomentsKernel kMoments = GetMomentsKernel(level);
+        int level_failures = 0;
+        for (const size_t size : kSizes) {
+            for (size_t offset = 0; offset <= 1; ++offset) {
+                level_failures += CompareSpectralKernel("convolution", level, kKernels.convolution,
+                    SpectralConvolutionScalar, size, offset, random);
+                level_failures += CompareSpectralKernel("correlation", level, kKernels.correlation,
+                    SpectralCorrelationScalar, size, offset, random);
+                level_failures += CompareMomentsKernel(level, kMoments, size, offset, random);
+            }
+        }
+        printf("%s: %s\n", LevelName(level), level_failures == 0 ? "ok" : "FAILED");
+        failures += level_failures;
+    }
+
+    return failures == 0 ? 0 : 1;
+}
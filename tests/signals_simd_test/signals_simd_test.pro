@@ -0,0 +1,30 @@
+# Unit test of the SIMD kernels of signals_simd.cpp against the scalar reference.
+# Build and run it with: qmake && make check
+
+TEMPLATE = app
+CONFIG += console c++11 testcase
+CONFIG -= app_bundle qt
+
+SOURCES += \
+    signals_simd_test.cpp \
+    ../../signals.cpp \
+    ../../signals_simd.cpp
+
+HEADERS += \
+    ../../signals.h \
+    ../../signals_simd.h
+
+QMAKE_CXXFLAGS+=-openmp
+
+win32: LIBS += -L$$PWD/../../third_party/fftw/lib/ -llibfftw3f-3
+unix: LIBS += -lfftw3f
+
+INCLUDEPATH += $$PWD/../../third_party/fftw/lib
+DEPENDPATH += $$PWD/../../third_party/fftw/lib
+
+# the test needs the FFTW DLL next to it, like the application
+copydata.commands = $(COPY_DIR) $$shell_quote($$shell_path($$PWD/../../third_party/bin)) $$shell_quote($$shell_path($$OUT_PWD))
+first.depends = $(first) copydata
+export(first.depends)
+export(copydata.commands)
+QMAKE_EXTRA_TARGETS += first copydata
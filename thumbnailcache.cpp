@@ -0,0 +1,106 @@
+#include "thumbnailcache.h"
+#include "cachedirectory.h"
+#include <QCache>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <iostream>
+
+// Bump when the way thumbnails are rendered changes, so that old entries are ignored.
+#define THUMBNAIL_CACHE_VERSION 1
+// Budget of the in-memory cache, in bytes of pixels.
+#define THUMBNAIL_MEMORY_CACHE_SIZE (32 * 1024 * 1024)
+#define THUMBNAIL_JPEG_QUALITY 85
+// Budget of the cache on disk. Thumbnails take a few kilobytes each, and editing the intro times
+// makes new ones every time, so it fills up over time.
+#define THUMBNAIL_DISK_CACHE_SIZE (256LL * 1024 * 1024)
+
+static QMutex memoryCacheMutex;
+static QCache<QString, QImage> memoryCache(THUMBNAIL_MEMORY_CACHE_SIZE);
+
+static CacheDirectory &thumbnailDirectory()
+{
+    static CacheDirectory directory(
+                QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/thumbnails",
+                "*.jpg", THUMBNAIL_DISK_CACHE_SIZE);
+    return directory;
+}
+
+QString ThumbnailCache::entryName(const QString &path, double time, int height, bool exact)
+{
+    QFileInfo fileInfo(path);
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(fileInfo.absoluteFilePath().toUtf8());
+    hash.addData(QByteArray::number(fileInfo.size()));
+    hash.addData(QByteArray::number(fileInfo.lastModified().toMSecsSinceEpoch()));
+    // to the millisecond, so that times computed slightly differently still hit
+    hash.addData(QByteArray::number(qRound64(time * 1000)));
+    hash.addData(QByteArray::number(height));
+    hash.addData(QByteArray::number(exact ? 1 : 0));
+    hash.addData(QByteArray::number(THUMBNAIL_CACHE_VERSION));
+
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+bool ThumbnailCache::load(const QString &path, double time, int height, bool exact, QImage *image)
+{
+    // a keyframe thumbnail can be replaced by an exact one, but not the other way around
+    const int variants = exact ? 1 : 2;
+    for (int i = 0; i < variants; ++i) {
+        const QString name = entryName(path, time, height, i == 0);
+
+        {
+            QMutexLocker locker(&memoryCacheMutex);
+            QImage *cached = memoryCache.object(name);
+            if (cached != nullptr) {
+                *image = *cached;
+                return true;
+            }
+        }
+
+        QImage loaded;
+        const QString entry = thumbnailDirectory().path() + "/" + name + ".jpg";
+        if (loaded.load(entry, "JPG")) {
+            CacheDirectory::touch(entry);
+            *image = loaded;
+            QMutexLocker locker(&memoryCacheMutex);
+            memoryCache.insert(name, new QImage(loaded), (int)loaded.sizeInBytes());
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThumbnailCache::store(const QString &path, double time, int height, bool exact, const QImage &image)
+{
+    if (image.isNull()) {
+        return;
+    }
+
+    const QString name = entryName(path, time, height, exact);
+    {
+        QMutexLocker locker(&memoryCacheMutex);
+        memoryCache.insert(name, new QImage(image), (int)image.sizeInBytes());
+    }
+
+    const QString directory = thumbnailDirectory().path();
+    if (!QDir().mkpath(directory)) {
+        return;
+    }
+    // written to a temporary file and renamed on commit, so that nobody sees a half-written one
+    QSaveFile file(directory + "/" + name + ".jpg");
+    if (!file.open(QIODevice::WriteOnly)) {
+        return;
+    }
+    if (!image.save(&file, "JPG", THUMBNAIL_JPEG_QUALITY) || !file.commit()) {
+        std::cerr << "Unable to write thumbnail cache entry for " << path.toStdString() << std::endl;
+        return;
+    }
+    thumbnailDirectory().added(QFileInfo(directory + "/" + name + ".jpg").size());
+}
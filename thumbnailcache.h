@@ -0,0 +1,26 @@
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <QImage>
+#include <QString>
+
+// Cache of rendered thumbnails, so that going back to times that have already been shown (by
+// scrubbing the intro times, scrolling back or reopening a library) doesn't decode video again.
+// Recently used thumbnails are kept in memory, and on disk as small JPEG files, up to a size
+// budget past which the least recently used ones are deleted (see CacheDirectory). Like the
+// audio cache, entries are named after a hash of the file's absolute path, size and modification
+// time plus the time and height of the thumbnail, so changed files simply miss.
+// All the functions are thread-safe, and failing to read or write the cache just behaves as a miss.
+class ThumbnailCache
+{
+public:
+    // Returns whether the thumbnail of the file at the given time is cached, and if so, stores it
+    // in image. Exact thumbnails are also returned when a keyframe one is asked for.
+    static bool load(const QString &path, double time, int height, bool exact, QImage *image);
+    static void store(const QString &path, double time, int height, bool exact, const QImage &image);
+
+private:
+    static QString entryName(const QString &path, double time, int height, bool exact);
+};
+
+#endif // THUMBNAILCACHE_H
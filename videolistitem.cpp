@@ -3,35 +3,54 @@
 #include "ffmpeg.h"
 #include "execution_timer.h"
 #include "misc_util.h"
-#include <QThreadPool>
-#include <QBuffer>
+#include "taskscheduler.h"
+#include "thumbnailcache.h"
 #include <QFileInfo>
 #include <QFontMetrics>
 #include <QGraphicsDropShadowEffect>
 
 void ThumbnailRenderTask::run() {
-    Image *images;
-    int height = 100;
+    // still queued when it was cancelled
+    if (job->cancelled) {
+        return;
+    }
 
-    QByteArray ba = path.toLocal8Bit();
-    get_video_frames(&images, ba.constData(), startTime, endTime, 5, height);
-
-    for (int i = 0; i < 5; ++i) {
-        Image image = *(images + i);
-        QImage qimage(image.data, image.width,
-                      image.height, image.width*3, QImage::Format_RGB888);
-        QByteArray ba;
-        QBuffer buffer(&ba);
-        buffer.open(QIODevice::ReadWrite);
-        qimage.save(&buffer, "PNG");
-        free(image.data);
-        image.data = (uint8_t*)malloc(ba.size());
-        memcpy(image.data, ba.data(), ba.size());
-        image.size = ba.size();
+    const int count = 5;
+    const int height = 100;
+
+    // the thumbnails are spread evenly over the intro, the same way get_video_frames does
+    const float deltaTime = (endTime - startTime)/double(count - 1);
+    bool allCached = true;
+    std::vector<Image> cached;
+    for (int i = 0; i < count; ++i) {
+        Image image;
+        image.count = i;
+        if (ThumbnailCache::load(path, startTime + i * deltaTime, height, exact, &image.image)) {
+            cached.push_back(image);
+        } else {
+            allCached = false;
+        }
+    }
+    for (const Image &image : cached) {
         emit sendThumbnailImage(image);
     }
+    if (allCached || job->cancelled) {
+        job->finished = true;
+        return;
+    }
 
-    free(images);
+    std::vector<Image> images;
+    QByteArray ba = path.toLocal8Bit();
+    get_video_frames(&images, ba.constData(), startTime, endTime, count, height, exact);
+
+    for (const Image &image : images) {
+        // kept even when cancelled, the decoding is done already
+        ThumbnailCache::store(path, startTime + image.count * deltaTime, height, exact, image.image);
+        if (!job->cancelled) {
+            emit sendThumbnailImage(image);
+        }
+    }
+    job->finished = true;
 }
 
 VideoListItem::VideoListItem(QWidget *parent, QString path)
@@ -59,21 +78,38 @@ VideoListItem::VideoListItem(QWidget *parent, QString path)
     QObject::connect(ui.endTime, &QTimeEdit::timeChanged, this, &VideoListItem::timeChanged);
 }
 
-void VideoListItem::renderThumbnails()
+void VideoListItem::renderThumbnails(bool exact)
 {
     if (!needsToRender || introStart > introEnd) {
         return;
     }
+    // the thumbnails of the previous times are obsolete
+    cancelThumbnails();
     needsToRender = false;
+    thumbnailJob = std::make_shared<ThumbnailJob>();
     ThumbnailRenderTask *task = new ThumbnailRenderTask();
     task->path = this->path;
     task->startTime = introStart;
     task->endTime = introEnd;
+    task->exact = exact;
+    task->job = thumbnailJob;
     QObject::connect(task,
                      &ThumbnailRenderTask::sendThumbnailImage,
                      this,
                      &VideoListItem::receiveThumbnailImage);
-    QThreadPool::globalInstance()->start(task);
+    TaskScheduler::start(task, TaskScheduler::VisibleThumbnailPriority);
+}
+
+void VideoListItem::cancelThumbnails()
+{
+    if (thumbnailJob == nullptr) {
+        return;
+    }
+    if (!thumbnailJob->finished) {
+        thumbnailJob->cancelled = true;
+        needsToRender = true;
+    }
+    thumbnailJob.reset();
 }
 
 void VideoListItem::receiveThumbnailImage(Image image)
@@ -96,14 +132,9 @@ void VideoListItem::receiveThumbnailImage(Image image)
         thumbnailLabel = ui.introThumbnail4;
         break;
     }
-    QPixmap pixmap = QPixmap();
-
-    pixmap.loadFromData(image.data, image.size);
+    QPixmap pixmap = QPixmap::fromImage(image.image);
     thumbnailLabel->setPixmap(pixmap);
     thumbnailLabel->setMinimumSize(pixmap.width(), pixmap.height());
-
-
-    free(image.data);
 }
 
 void VideoListItem::updateWithResult(const FindSoundResult &findSoundResult)
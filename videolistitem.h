@@ -1,27 +1,39 @@
 #ifndef VIDEOLISTITEM_H
 #define VIDEOLISTITEM_H
 
+#include <QImage>
 #include <QWidget>
 #include <QRunnable>
+#include <atomic>
+#include <memory>
 #include "ui_videolistitem.h"
 #include "findsound.h"
 
+// A thumbnail and its position in the row. QImage is implicitly shared, so it can be sent across
+// threads without copying the pixels.
 struct Image {
-    uint8_t *data;
-    int size;
-    int width;
-    int height;
+    QImage image;
     int count;
 };
 
 Q_DECLARE_METATYPE(Image);
 
+// Shared between an item and the render task it started, so that the item can give up on the task
+// once its thumbnails are no longer wanted (scrolled out of view, or the times changed).
+struct ThumbnailJob {
+    std::atomic<bool> cancelled{false};
+    std::atomic<bool> finished{false};
+};
+
 class ThumbnailRenderTask : public QObject, public QRunnable {
     Q_OBJECT
 public:
     QString path;
     float startTime;
     float endTime;
+    // whether the thumbnails must be at the exact times, or the closest keyframes are good enough
+    bool exact = true;
+    std::shared_ptr<ThumbnailJob> job;
     void run() override;
 signals:
     void sendThumbnailImage(Image image);
@@ -34,7 +46,10 @@ public:
     Ui::VideoFileListItem ui;
     bool isVisible = false;
     explicit VideoListItem(QWidget *parent = nullptr, QString path = nullptr);
-    void renderThumbnails();
+    void renderThumbnails(bool exact = true);
+    // Drops the thumbnails being rendered, if any; they are rendered again on the next call to
+    // renderThumbnails.
+    void cancelThumbnails();
     void updateWithResult(const FindSoundResult &findSoundResult);
 
 private slots:
@@ -44,6 +59,7 @@ private slots:
 private:
     QString path;
     bool needsToRender = true;
+    std::shared_ptr<ThumbnailJob> thumbnailJob;
     float introStart = 0.0f;
     float introEnd = 60.0f;
     void setIntroTime(const float start, const float end, bool skipQt);